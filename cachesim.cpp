@@ -1,7 +1,742 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "cachesim.hpp"
+#include "classify.hpp"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-static cache_t cache_metadata;
-static uint64_t logical_clock;
+static cache_sim_t default_cache;
+
+static inline int bit_test(const uint64_t *mask, uint64_t way) {
+	return (mask[way / 64] >> (way % 64)) & 1;
+}
+
+static inline void bit_assign(uint64_t *mask, uint64_t way, int value) {
+	mask[way / 64] = (mask[way / 64] & ~(1ULL << (way % 64))) | ((uint64_t) value << (way % 64));
+}
+
+/**
+ * Bitmask of the n <= 64 ways starting at tags whose tag equals tag.
+ */
+static inline uint64_t match_tags(const uint64_t *tags, uint64_t n, uint64_t tag) {
+	uint64_t mask = 0, w = 0;
+#if defined(__AVX2__)
+	__m256i key = _mm256_set1_epi64x(tag);
+
+	for (; w + 4 <= n; w += 4) {
+		__m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (tags + w)), key);
+		mask |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(eq)) << w;
+	}
+#elif defined(__SSE2__)
+	__m128i key = _mm_set1_epi64x(tag);
+
+	for (; w + 2 <= n; w += 2) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (tags + w)), key);
+		// a lane matches when both of its 32 bit halves do
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		mask |= (uint64_t) _mm_movemask_pd(_mm_castsi128_pd(eq)) << w;
+	}
+#endif
+	for (; w < n; w++) {
+		mask |= (uint64_t) (tags[w] == tag) << w;
+	}
+	return mask;
+}
+
+/**
+ * First way in [0, n) valid in neither mask, n if there is none.
+ *
+ * @valid2 NULL to look at valid1 alone
+ */
+static inline uint64_t first_invalid(const uint64_t *valid1, const uint64_t *valid2, uint64_t n) {
+	uint64_t word, bits;
+
+	for (word=0; word*64<n; word++) {
+		bits = ~(valid1[word] | (valid2 ? valid2[word] : 0));
+		if ((n - word*64) < 64) {
+			bits &= (1ULL << (n - word*64)) - 1;
+		}
+		if (bits) {
+			return word*64 + __builtin_ctzll(bits);
+		}
+	}
+	return n;
+}
+
+/**
+ * Point part at the next cache line aligned piece of an arena starting at
+ * base, or only count its size when base is NULL.
+ */
+template <typename T>
+static inline void arena_carve(char *base, uint64_t *used, T **part, uint64_t count) {
+	*part = base ? (T *) (base + *used) : NULL;
+	*used += (sizeof(T) * count + ARENA_ALIGN - 1) & ~(uint64_t) (ARENA_ALIGN - 1);
+}
+
+cache_sim_t::cache_sim_t() : logical_clock(0), last_block(0), last_index(0), last_way(NO_WAY),
+                             drop_out(NULL), classifier(NULL), arena(NULL), arena_size(0), arena_used(0), huge_pages(0),
+                             arena_from_file(0), write_policy(DEFAULT_W),
+                             allocate_policy(DEFAULT_A), prefetcher(DEFAULT_P), prefetch_head(0),
+                             prefetch_count(0) {
+	memset(&cache_metadata, 0, sizeof(cache_metadata));
+	memset(streams, 0, sizeof(streams));
+	select_kernels(1);
+}
+
+cache_sim_t::~cache_sim_t() {
+	free_cache();
+}
+
+/**
+ * Drop the configuration and unmap the arena. setup_cache keeps the arena
+ * instead when the next configuration fits in it.
+ */
+void cache_sim_t::free_cache() {
+	if (arena) {
+		munmap(arena, arena_size);
+	}
+	arena = NULL;
+	arena_size = 0;
+	arena_used = 0;
+	arena_from_file = 0;
+	memset(&cache_metadata, 0, sizeof(cache_metadata));
+	logical_clock = 0;
+	last_way = NO_WAY;
+	pending_dirty.clear();
+}
+
+/**
+ * Back arenas of 2MB and more with transparent huge pages, which saves
+ * TLB misses on large tag stores. Takes effect at the next setup_cache.
+ */
+void cache_sim_t::use_huge_pages(int on) {
+	huge_pages = on;
+}
+
+/**
+ * Choose what a store does. WRITE_BACK marks the line dirty and writes it
+ * out when it leaves, WRITE_THROUGH sends every store to memory and keeps
+ * lines clean. With NO_WRITE_ALLOCATE a store that misses both the main
+ * and the victim cache goes around them instead of filling a line. Set
+ * before simulating.
+ */
+void cache_sim_t::set_write_policy(char write, char allocate) {
+	write_policy = write;
+	allocate_policy = allocate;
+}
+
+/**
+ * Prefetch on demand misses and on the first use of a prefetched line:
+ * PREFETCH_NEXT_LINE the next line, PREFETCH_STRIDE further along a
+ * stream of misses with a constant stride, PREFETCH_HALF the other half
+ * of a SUBBLOCKING line. Takes effect at the next setup_cache.
+ */
+void cache_sim_t::set_prefetcher(char prefetcher) {
+	this->prefetcher = prefetcher;
+}
+
+/**
+ * Report every demand access to classifier, set up for the same geometry,
+ * or stop with NULL. Without one the access path only tests the pointer.
+ */
+void cache_sim_t::set_classifier(miss_classifier_t *classifier) {
+	this->classifier = classifier;
+}
+
+/**
+ * Bytes a line moves to or from memory, only its valid halves when
+ * SUBBLOCKING.
+ */
+uint64_t cache_sim_t::line_bytes(const cache_entry_t *entry) const {
+	if (cache_metadata.block_type == BLOCKING) {
+		return cache_metadata.cacheline_size;
+	}
+	return (entry->valid1 + entry->valid2) * (cache_metadata.cacheline_size/2);
+}
+
+/**
+ * Count the writeback of a line leaving the cache, if it is dirty.
+ */
+void cache_sim_t::write_back(const cache_entry_t *entry, cache_stats_t* p_stats) {
+	if (entry->dirty && (entry->valid1 || entry->valid2)) {
+		p_stats->writebacks++;
+		p_stats->bytes_written += line_bytes(entry);
+	}
+}
+
+/**
+ * Write back every dirty line still in the main and the victim cache and
+ * leave them clean, as at the end of a run. Prefetched lines still unused
+ * count as useless.
+ */
+void cache_sim_t::flush_dirty(cache_stats_t *p_stats) {
+	const uint64_t words = cache_metadata.total_sets * cache_metadata.mask_words;
+	const uint64_t half = cache_metadata.cacheline_size/2;
+	victim_index_t *vi = &cache_metadata.victim_index;
+	std::unordered_set<uint64_t>::const_iterator it;
+	uint64_t w, dirty, tag, index, block_offset, way;
+	cache_entry_t line;
+	uint32_t slot;
+
+	// a pending block still in its set is dirty whatever its bit says
+	for (it=pending_dirty.begin(); it!=pending_dirty.end(); ++it) {
+		decode_address(*it << cache_metadata.block_offset_size, &tag, &index, &block_offset);
+		way = find_way(index, tag);
+		if (way != NO_WAY) {
+			bit_assign(cache_metadata.dirty + index * cache_metadata.mask_words, way, 1);
+		}
+	}
+	pending_dirty.clear();
+
+	for (w=0; w<words; w++) {
+		if (!cache_metadata.dirty[w]) {
+			continue;
+		}
+		dirty = cache_metadata.dirty[w] & (cache_metadata.valid1[w] | cache_metadata.valid2[w]);
+		p_stats->writebacks += __builtin_popcountll(dirty);
+		if (cache_metadata.block_type == BLOCKING) {
+			p_stats->bytes_written += __builtin_popcountll(dirty) * cache_metadata.cacheline_size;
+		} else {
+			p_stats->bytes_written += (__builtin_popcountll(dirty & cache_metadata.valid1[w]) +
+			                           __builtin_popcountll(dirty & cache_metadata.valid2[w])) * half;
+		}
+		cache_metadata.dirty[w] = 0;
+	}
+
+	for (slot=vi->lru; slot!=VICTIM_NONE; slot=vi->next[slot]) {
+		line = cache_metadata.victim_cache[slot];
+		write_back(&line, p_stats);
+		cache_metadata.victim_cache[slot].dirty = 0;
+	}
+
+	// prefetched data nothing used by the end never will be
+	if (cache_metadata.prefetch1) {
+		for (w=0; w<words; w++) {
+			p_stats->prefetch_useless +=
+				__builtin_popcountll(cache_metadata.prefetch1[w] & cache_metadata.valid1[w]) +
+				__builtin_popcountll(cache_metadata.prefetch2[w] & cache_metadata.valid2[w]);
+			cache_metadata.prefetch1[w] = 0;
+			cache_metadata.prefetch2[w] = 0;
+		}
+		for (slot=vi->lru; slot!=VICTIM_NONE; slot=vi->next[slot]) {
+			p_stats->prefetch_useless += cache_metadata.victim_cache[slot].prefetch1 +
+			                             cache_metadata.victim_cache[slot].prefetch2;
+			cache_metadata.victim_cache[slot].prefetch1 = 0;
+			cache_metadata.victim_cache[slot].prefetch2 = 0;
+		}
+	}
+}
+
+/*
+ * Replacement policies. replacement<R> carves the state of policy R out of
+ * the arena, counts its bits of storage overhead and has the hooks
+ * main_kernel calls: victim picks the way a miss replaces, evict runs once
+ * that line has been copied for the victim cache and returns the way to
+ * fill, hit and fill update the state, and remove frees a way for
+ * invalidate. replacement<0> looks the policy up at run time for the
+ * generic kernel. A new policy is one more specialization, one more case
+ * in REPLACEMENT_CASES and one more row of kernels in select_kernels.
+ */
+
+struct replacement_defaults {
+	// no state is shared between sets, so the sets can be sharded
+	static int per_set() {
+		return 1;
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t evict(cache_sim_t *, uint64_t, uint64_t way) {
+		return way;
+	}
+
+	static uint64_t remove(cache_sim_t *, uint64_t, uint64_t way) {
+		return way;
+	}
+};
+
+template <>
+struct replacement<LRU> : replacement_defaults {
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		arena_carve(base, used, &m->lru_prev, m->total_sets * m->blocks_per_set);
+		arena_carve(base, used, &m->lru_next, m->total_sets * m->blocks_per_set);
+		arena_carve(base, used, &m->lru_head, m->total_sets);
+		arena_carve(base, used, &m->lru_tail, m->total_sets);
+	}
+
+	// a rank of up to 8 bits per line
+	static uint64_t overhead_bits(const cache_t *m) {
+		return 8 * m->total_sets * m->blocks_per_set;
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		__builtin_prefetch(m->lru_prev + index * (WAYS ? WAYS : m->blocks_per_set));
+		__builtin_prefetch(m->lru_tail + index);
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t victim(cache_sim_t *sim, uint64_t index) {
+		return sim->lru_entry_to_update<ST, WAYS>(index);
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t) {
+		sim->lru_touch<WAYS>(index, way);
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t) {
+		sim->lru_touch<WAYS>(index, way);
+	}
+};
+
+template <>
+struct replacement<NMRU_FIFO> : replacement_defaults {
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		arena_carve(base, used, &m->nmru_reg, m->total_sets);
+		arena_carve(base, used, &m->fifo_head, m->total_sets);
+	}
+
+	// a FIFO position and an MRU bit of up to 4 bits per line
+	static uint64_t overhead_bits(const cache_t *m) {
+		return 4 * m->total_sets * m->blocks_per_set;
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		__builtin_prefetch(m->nmru_reg + index);
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t victim(cache_sim_t *sim, uint64_t index) {
+		return sim->nmru_entry_to_update<ST, WAYS>(index);
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t evict(cache_sim_t *sim, uint64_t index, uint64_t way) {
+		return sim->nmru_push_entry<ST, WAYS>(index, way);
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t, uint64_t tag) {
+		sim->cache_metadata.nmru_reg[index] = tag;
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t, uint64_t tag, uint64_t) {
+		sim->cache_metadata.nmru_reg[index] = tag;
+	}
+
+	// the younger ways move one step towards the oldest so the valid ways
+	// stay contiguous in the ring, and the newest slot is the one freed
+	static uint64_t remove(cache_sim_t *sim, uint64_t index, uint64_t way) {
+		uint64_t count = sim->valid_ways<0, 0>(index);
+		uint64_t mask = sim->cache_metadata.blocks_per_set - 1;
+		uint64_t head = sim->cache_metadata.fifo_head[index];
+		uint64_t pos;
+
+		for (pos=(way - head) & mask; pos+1<count; pos++) {
+			sim->move_way(index, (head + pos + 1) & mask, (head + pos) & mask);
+		}
+		return (head + count - 1) & mask;
+	}
+};
+
+template <>
+struct replacement<TREE_PLRU> : replacement_defaults {
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		arena_carve(base, used, &m->plru, m->total_sets * m->mask_words);
+	}
+
+	// one bit per inner node of the tree
+	static uint64_t overhead_bits(const cache_t *m) {
+		return (m->blocks_per_set - 1) * m->total_sets;
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		__builtin_prefetch(m->plru + index * (WAYS ? (WAYS + 63) / 64 : m->mask_words));
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t victim(cache_sim_t *sim, uint64_t index) {
+		const cache_t *m = &sim->cache_metadata;
+		const uint64_t ways = WAYS ? WAYS : m->blocks_per_set;
+		const uint64_t *tree = m->plru + index * (WAYS ? (WAYS + 63) / 64 : m->mask_words);
+		uint64_t node;
+
+		node = sim->first_invalid_way<ST, WAYS>(index);
+		if (node < ways) {
+			return node;
+		}
+		// the leaves are nodes ways to 2 * ways - 1
+		for (node=1; node<ways; ) {
+			node = 2 * node + bit_test(tree, node);
+		}
+		return node - ways;
+	}
+
+	// point every node on the way's path at the other subtree
+	template <uint64_t WAYS>
+	static void touch(cache_t *m, uint64_t index, uint64_t way) {
+		const uint64_t ways = WAYS ? WAYS : m->blocks_per_set;
+		uint64_t *tree = m->plru + index * (WAYS ? (WAYS + 63) / 64 : m->mask_words);
+		uint64_t node;
+
+		for (node=way + ways; node>1; node/=2) {
+			bit_assign(tree, node / 2, !(node & 1));
+		}
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t) {
+		touch<WAYS>(&sim->cache_metadata, index, way);
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t) {
+		touch<WAYS>(&sim->cache_metadata, index, way);
+	}
+};
+
+/**
+ * SRRIP, a 2 bit RRPV per line. The other RRIP policies keep the same
+ * RRPVs and victim search and only fill with other values.
+ */
+template <>
+struct replacement<SRRIP> : replacement_defaults {
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		m->rrpv_words = (2 * m->blocks_per_set + 63) / 64;
+		arena_carve(base, used, &m->rrpv, m->total_sets * m->rrpv_words);
+	}
+
+	static uint64_t overhead_bits(const cache_t *m) {
+		return 2 * m->total_sets * m->blocks_per_set;
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		__builtin_prefetch(m->rrpv + index * (WAYS ? (2 * WAYS + 63) / 64 : m->rrpv_words));
+	}
+
+	template <uint64_t WAYS>
+	static void set(cache_t *m, uint64_t index, uint64_t way, uint64_t value) {
+		uint64_t *word = m->rrpv + index * (WAYS ? (2 * WAYS + 63) / 64 : m->rrpv_words) + way / 32;
+		uint64_t shift = 2 * (way % 32);
+
+		*word = (*word & ~(3ULL << shift)) | (value << shift);
+	}
+
+	// the first line predicted re-referenced furthest away, ageing the set
+	// until there is one
+	template <char ST, uint64_t WAYS>
+	static uint64_t victim(cache_sim_t *sim, uint64_t index) {
+		const cache_t *m = &sim->cache_metadata;
+		const uint64_t ways = WAYS ? WAYS : m->blocks_per_set;
+		const uint64_t words = WAYS ? (2 * WAYS + 63) / 64 : m->rrpv_words;
+		uint64_t *rrpv = m->rrpv + index * words;
+		uint64_t w, live, distant, entry;
+
+		entry = sim->first_invalid_way<ST, WAYS>(index);
+		if (entry < ways) {
+			return entry;
+		}
+		for (;;) {
+			for (w=0; w<words; w++) {
+				live = ((ways - w*32) < 32) ? (1ULL << (2 * (ways - w*32))) - 1 : ~0ULL;
+				distant = rrpv[w] & (rrpv[w] >> 1) & 0x5555555555555555ULL & live;
+				if (distant) {
+					return w*32 + __builtin_ctzll(distant) / 2;
+				}
+			}
+			// no field is RRPV_MAX, so adding one to each cannot carry
+			for (w=0; w<words; w++) {
+				live = ((ways - w*32) < 32) ? (1ULL << (2 * (ways - w*32))) - 1 : ~0ULL;
+				rrpv[w] += 0x5555555555555555ULL & live;
+			}
+		}
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t) {
+		set<WAYS>(&sim->cache_metadata, index, way, 0);
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t) {
+		set<WAYS>(&sim->cache_metadata, index, way, RRPV_LONG);
+	}
+};
+
+/**
+ * RRPV_LONG once every BRRIP_THROTTLE fills, else RRPV_MAX.
+ */
+static inline uint64_t bimodal_rrpv(cache_t *m) {
+	return (m->duel[1]++ % BRRIP_THROTTLE) ? RRPV_MAX : RRPV_LONG;
+}
+
+template <>
+struct replacement<BRRIP> : replacement<SRRIP> {
+	static int per_set() {
+		return 0;
+	}
+
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		replacement<SRRIP>::carve(m, base, used);
+		arena_carve(base, used, &m->duel, 2);
+	}
+
+	// and the throttle counter
+	static uint64_t overhead_bits(const cache_t *m) {
+		return replacement<SRRIP>::overhead_bits(m) + 5;
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t) {
+		set<WAYS>(&sim->cache_metadata, index, way, bimodal_rrpv(&sim->cache_metadata));
+	}
+};
+
+template <>
+struct replacement<DRRIP> : replacement<SRRIP> {
+	static int per_set() {
+		return 0;
+	}
+
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		replacement<SRRIP>::carve(m, base, used);
+		arena_carve(base, used, &m->duel, 2);
+	}
+
+	// and the selector and the throttle counter
+	static uint64_t overhead_bits(const cache_t *m) {
+		return replacement<SRRIP>::overhead_bits(m) + 10 + 5;
+	}
+
+	// a miss in a leader set counts against its policy, the followers fill
+	// the way the policy missing less would
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t) {
+		cache_t *m = &sim->cache_metadata;
+		int64_t *psel = m->duel;
+		uint64_t value;
+
+		if ((index % DUEL_PERIOD) == 0) {
+			*psel += (*psel < PSEL_MAX);
+			value = RRPV_LONG;
+		} else if ((index % DUEL_PERIOD) == 1) {
+			*psel -= (*psel > -PSEL_MAX - 1);
+			value = bimodal_rrpv(m);
+		} else {
+			value = (*psel > 0) ? bimodal_rrpv(m) : RRPV_LONG;
+		}
+		set<WAYS>(m, index, way, value);
+	}
+};
+
+/**
+ * SHiP: the SRRIP victim search, with each fill predicted by a saturating
+ * counter for the memory region it came from. A line that leaves without
+ * a hit counts its region down, the first hit counts it up, so regions a
+ * scan passes through are filled as distant and go first.
+ */
+template <>
+struct replacement<SHIP> : replacement<SRRIP> {
+	static int per_set() {
+		return 0;
+	}
+
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		replacement<SRRIP>::carve(m, base, used);
+		arena_carve(base, used, &m->ship_line, m->total_sets * m->blocks_per_set);
+		arena_carve(base, used, &m->shct, (uint64_t) 1 << SHIP_SIG_BITS);
+	}
+
+	// a signature and a reuse bit per line, and 3 bit counters
+	static uint64_t overhead_bits(const cache_t *m) {
+		return replacement<SRRIP>::overhead_bits(m) +
+		       (SHIP_SIG_BITS + 1) * m->total_sets * m->blocks_per_set +
+		       ((uint64_t) 3 << SHIP_SIG_BITS);
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		replacement<SRRIP>::prefetch<WAYS>(m, index);
+		__builtin_prefetch(m->ship_line + index * (WAYS ? WAYS : m->blocks_per_set));
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t evict(cache_sim_t *sim, uint64_t index, uint64_t way) {
+		cache_t *m = &sim->cache_metadata;
+		uint16_t line = m->ship_line[index * (WAYS ? WAYS : m->blocks_per_set) + way];
+
+		if (sim->way_valid<ST>(index, way) && !(line & SHIP_REUSED) && m->shct[line]) {
+			m->shct[line]--;
+		}
+		return way;
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t) {
+		cache_t *m = &sim->cache_metadata;
+		uint16_t *line = m->ship_line + index * (WAYS ? WAYS : m->blocks_per_set) + way;
+
+		set<WAYS>(m, index, way, 0);
+		if (!(*line & SHIP_REUSED)) {
+			m->shct[*line] += (m->shct[*line] < SHCT_MAX);
+			*line |= SHIP_REUSED;
+		}
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t, uint64_t address) {
+		cache_t *m = &sim->cache_metadata;
+		uint16_t sig = ((address >> SHIP_REGION_BITS) * 0x9e3779b97f4a7c15ULL) >> (64 - SHIP_SIG_BITS);
+
+		m->ship_line[index * (WAYS ? WAYS : m->blocks_per_set) + way] = sig;
+		set<WAYS>(m, index, way, m->shct[sig] ? RRPV_LONG : RRPV_MAX);
+	}
+};
+
+#define REPLACEMENT_CASES(r, ...) \
+	switch (r) { \
+	case NMRU_FIFO: return replacement<NMRU_FIFO>::__VA_ARGS__; \
+	case TREE_PLRU: return replacement<TREE_PLRU>::__VA_ARGS__; \
+	case SRRIP: return replacement<SRRIP>::__VA_ARGS__; \
+	case BRRIP: return replacement<BRRIP>::__VA_ARGS__; \
+	case DRRIP: return replacement<DRRIP>::__VA_ARGS__; \
+	case SHIP: return replacement<SHIP>::__VA_ARGS__; \
+	default: return replacement<LRU>::__VA_ARGS__; \
+	}
+
+template <>
+struct replacement<0> {
+	static int per_set(const cache_t *m) {
+		REPLACEMENT_CASES(m->replacement_policy, per_set());
+	}
+
+	static void carve(cache_t *m, char *base, uint64_t *used) {
+		REPLACEMENT_CASES(m->replacement_policy, carve(m, base, used));
+	}
+
+	static uint64_t overhead_bits(const cache_t *m) {
+		REPLACEMENT_CASES(m->replacement_policy, overhead_bits(m));
+	}
+
+	template <uint64_t WAYS>
+	static void prefetch(const cache_t *m, uint64_t index) {
+		REPLACEMENT_CASES(m->replacement_policy, prefetch<WAYS>(m, index));
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t victim(cache_sim_t *sim, uint64_t index) {
+		REPLACEMENT_CASES(sim->cache_metadata.replacement_policy, victim<ST, WAYS>(sim, index));
+	}
+
+	template <char ST, uint64_t WAYS>
+	static uint64_t evict(cache_sim_t *sim, uint64_t index, uint64_t way) {
+		REPLACEMENT_CASES(sim->cache_metadata.replacement_policy, evict<ST, WAYS>(sim, index, way));
+	}
+
+	template <uint64_t WAYS>
+	static void hit(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t tag) {
+		REPLACEMENT_CASES(sim->cache_metadata.replacement_policy, hit<WAYS>(sim, index, way, tag));
+	}
+
+	template <uint64_t WAYS>
+	static void fill(cache_sim_t *sim, uint64_t index, uint64_t way, uint64_t tag,
+	                 uint64_t address) {
+		REPLACEMENT_CASES(sim->cache_metadata.replacement_policy,
+		                  fill<WAYS>(sim, index, way, tag, address));
+	}
+
+	static uint64_t remove(cache_sim_t *sim, uint64_t index, uint64_t way) {
+		REPLACEMENT_CASES(sim->cache_metadata.replacement_policy, remove(sim, index, way));
+	}
+};
+
+const char *replacement_name(char r) {
+	switch (r) {
+	case LRU:
+		return "LRU";
+	case NMRU_FIFO:
+		return "NMRU_FIFO";
+	case TREE_PLRU:
+		return "TREE_PLRU";
+	case SRRIP:
+		return "SRRIP";
+	case BRRIP:
+		return "BRRIP";
+	case DRRIP:
+		return "DRRIP";
+	case SHIP:
+		return "SHIP";
+	}
+	return NULL;
+}
+
+/**
+ * Carve every per set and victim cache array out of base, which is NULL
+ * to only size them. Returns the bytes needed.
+ */
+uint64_t cache_sim_t::layout_arena(char *base) {
+	uint64_t sets = cache_metadata.total_sets;
+	uint64_t lines = sets * cache_metadata.blocks_per_set;
+	uint64_t words = sets * cache_metadata.mask_words;
+	uint64_t victims = cache_metadata.victim_blocks;
+	victim_index_t *vi = &cache_metadata.victim_index;
+	uint64_t used = 0;
+
+	arena_carve(base, &used, &cache_metadata.tags, lines);
+	arena_carve(base, &used, &cache_metadata.valid1, words);
+	arena_carve(base, &used, &cache_metadata.valid2, words);
+	arena_carve(base, &used, &cache_metadata.dirty, words);
+	if (prefetcher != PREFETCH_NONE) {
+		arena_carve(base, &used, &cache_metadata.prefetch1, words);
+		arena_carve(base, &used, &cache_metadata.prefetch2, words);
+		arena_carve(base, &used, &cache_metadata.pollution, POLLUTION_FILTER);
+	}
+	replacement<0>::carve(&cache_metadata, base, &used);
+	arena_carve(base, &used, &cache_metadata.victim_cache, victims);
+	arena_carve(base, &used, &vi->buckets, (uint64_t) 1 << vi->hash_bits);
+	arena_carve(base, &used, &vi->chain, victims);
+	arena_carve(base, &used, &vi->prev, victims);
+	arena_carve(base, &used, &vi->next, victims);
+	arena_carve(base, &used, &vi->free_slots, victims);
+	return used;
+}
+
+/**
+ * Bytes of the arena the trace has actually touched so far.
+ */
+uint64_t cache_sim_t::host_bytes_resident() const {
+	unsigned char pages[4096];
+	uint64_t offset, len, j, resident = 0;
+
+	for (offset=0; offset<arena_size; offset+=len) {
+		len = arena_size - offset;
+		if (len > (uint64_t) ARENA_PAGE * sizeof(pages)) {
+			len = (uint64_t) ARENA_PAGE * sizeof(pages);
+		}
+		if (mincore(arena + offset, len, pages) < 0) {
+			return arena_used;
+		}
+		for (j=0; j<(len + ARENA_PAGE - 1) / ARENA_PAGE; j++) {
+			resident += (pages[j] & 1) * ARENA_PAGE;
+		}
+	}
+	return resident;
+}
+
+/**
+ * Host bytes the simulator reserves per simulated main cache line.
+ */
+double cache_sim_t::host_bytes_per_line() const {
+	return (double) arena_used / (cache_metadata.total_sets * cache_metadata.blocks_per_set);
+}
 
 /**
  * Subroutine for initializing the cache. You many add and initialize any global or heap
@@ -13,21 +748,39 @@ static uint64_t logical_clock;
  * @s The number of blocks in each set is 2^S
  * @v The number of blocks in the victim cache is 2^V
  * @st The storage policy, BLOCKING or SUBBLOCKING (refer to project description for details)
- * @r The replacement policy, LRU or NMRU_FIFO (refer to project description for details)
+ * @r The replacement policy, LRU, NMRU_FIFO, TREE_PLRU, SRRIP, BRRIP, DRRIP or SHIP
  */
-void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r) {
+void cache_sim_t::setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r) {
 	uint64_t overhead_bits = 0, victim_overhead_bits = 0;
-	uint64_t i;
+	uint64_t i, align;
+	victim_index_t *vi;
+
+	// list links are way + 1 in 32 bits, victim slots 32 bit indices
+	if ((c >= ADDRESS_SIZE) || ((b + s) > c) || (s >= 32) || (v >= 32)) {
+		fprintf(stderr, "unsupported geometry C=%" PRIu64 " B=%" PRIu64 " S=%" PRIu64
+		        " V=%" PRIu64 "\n", c, b, s, v);
+		exit(1);
+	}
+
+	// an instance can be set up again for another configuration, the
+	// arena is kept for it
+	memset(&cache_metadata, 0, sizeof(cache_metadata));
+	logical_clock = 0;
+	last_way = NO_WAY;
+	pending_dirty.clear();
+	prefetch_head = 0;
+	prefetch_count = 0;
+	memset(streams, 0, sizeof(streams));
 
 	// convert the inputs to actual size
-	cache_metadata.total_data_storage = 1 << c;
+	cache_metadata.total_data_storage = (uint64_t) 1 << c;
 	cache_metadata.block_type = st;
 	cache_metadata.replacement_policy = r;
-	cache_metadata.blocks_per_set = 1 << s;
-	cache_metadata.cacheline_size = 1 << b;
-	cache_metadata.victim_blocks = 1 << v;
+	cache_metadata.blocks_per_set = (uint64_t) 1 << s;
+	cache_metadata.cacheline_size = (uint64_t) 1 << b;
+	cache_metadata.victim_blocks = (uint64_t) 1 << v;
 
-	cache_metadata.total_sets =  (1 << (c - (b + s)));
+	cache_metadata.total_sets =  ((uint64_t) 1 << (c - (b + s)));
 
 	cache_metadata.block_offset_size = b;
 	cache_metadata.index_size = (c - (b + s));
@@ -37,10 +790,11 @@ void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r
 	// add the dirty bit to overhead	
 	overhead_bits++;
 	overhead_bits += ((cache_metadata.block_type == BLOCKING) ? 1 : 2);
-	overhead_bits += ((cache_metadata.replacement_policy == LRU) ? 8 : 4);
 	overhead_bits += cache_metadata.tag_size;
 	overhead_bits = overhead_bits *
 		            (cache_metadata.total_data_storage / cache_metadata.cacheline_size);
+	// and whatever state the replacement policy keeps
+	overhead_bits += replacement<0>::overhead_bits(&cache_metadata);
 
 	// calculate the overhead bits for victim cache
 	// start with dirty
@@ -49,406 +803,1476 @@ void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r
 	// victim cache is always LRU.
 	victim_overhead_bits += 8;
 	victim_overhead_bits += 64 - b;
-	victim_overhead_bits = victim_overhead_bits * (1 << v);
+	victim_overhead_bits = victim_overhead_bits * cache_metadata.victim_blocks;
 
 	// convert to bytes
 	cache_metadata.total_overhead_bits = overhead_bits + victim_overhead_bits;
 
 	// total_storage = main + victim
-	cache_metadata.total_storage = cache_metadata.total_data_storage + (cache_metadata.cacheline_size * (1<<v));
+	cache_metadata.total_storage = cache_metadata.total_data_storage + (cache_metadata.cacheline_size * cache_metadata.victim_blocks);
+
+	cache_metadata.mask_words = (cache_metadata.blocks_per_set + 63) / 64;
+
+	// at least twice as many hash chains as victim slots
+	vi = &cache_metadata.victim_index;
+	vi->hash_bits = 1;
+	while ((1ULL << vi->hash_bits) < 2 * cache_metadata.victim_blocks) {
+		vi->hash_bits++;
+	}
+
+	// One arena for the whole tag store, reused when the last one fits.
+	// Nothing in a set needs initializing, so the pages of a set are only
+	// allocated when the trace first touches it and host memory follows
+	// the working set rather than the configured capacity.
+	arena_used = layout_arena(NULL);
+	if ((arena_used > arena_size) || arena_from_file) {
+		if (arena) {
+			munmap(arena, arena_size);
+		}
+		align = (huge_pages && (arena_used >= ARENA_HUGE_PAGE)) ? ARENA_HUGE_PAGE : ARENA_PAGE;
+		arena_size = (arena_used + align - 1) & ~(align - 1);
+		arena = (char *) mmap(NULL, arena_size, PROT_READ | PROT_WRITE,
+		                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (arena == MAP_FAILED) {
+			perror("tag store");
+			exit(1);
+		}
+		arena_from_file = 0;
+#ifdef MADV_HUGEPAGE
+		if (align == ARENA_HUGE_PAGE) {
+			madvise(arena, arena_size, MADV_HUGEPAGE);
+		}
+#endif
+	} else {
+		// hand the old pages back, they read as zero again on next touch
+		madvise(arena, arena_size, MADV_DONTNEED);
+	}
+	layout_arena(arena);
+
+	// lowest slot on top, the order the linear scan used to fill them in
+	memset(vi->buckets, 0xff, sizeof(uint32_t) << vi->hash_bits);
+	for (i=0; i<cache_metadata.victim_blocks; i++) {
+		vi->free_slots[i] = cache_metadata.victim_blocks - 1 - i;
+	}
+	vi->free_count = cache_metadata.victim_blocks;
+	vi->lru = VICTIM_NONE;
+	vi->mru = VICTIM_NONE;
+
+	select_kernels(0);
+}
+
+static inline uint32_t victim_hash(uint64_t vict_tag, uint32_t bits) {
+	return (vict_tag * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+/**
+ * Slot of the valid victim entry holding block vict_tag, VICTIM_NONE if
+ * it is not in the victim cache.
+ */
+uint32_t cache_sim_t::victim_find(uint64_t vict_tag) const {
+	const victim_index_t *vi = &cache_metadata.victim_index;
+	uint32_t slot = vi->buckets[victim_hash(vict_tag, vi->hash_bits)];
+
+	while ((slot != VICTIM_NONE) && (cache_metadata.victim_cache[slot].tag != vict_tag)) {
+		slot = vi->chain[slot];
+	}
+	return slot;
+}
+
+/**
+ * Take a valid slot out of the hash index and the LRU list.
+ */
+void cache_sim_t::victim_unlink(uint32_t slot) {
+	victim_index_t *vi = &cache_metadata.victim_index;
+	uint32_t *link = &vi->buckets[victim_hash(cache_metadata.victim_cache[slot].tag, vi->hash_bits)];
+
+	while (*link != slot) {
+		link = &vi->chain[*link];
+	}
+	*link = vi->chain[slot];
+
+	if (vi->prev[slot] != VICTIM_NONE) {
+		vi->next[vi->prev[slot]] = vi->next[slot];
+	} else {
+		vi->lru = vi->next[slot];
+	}
+	if (vi->next[slot] != VICTIM_NONE) {
+		vi->prev[vi->next[slot]] = vi->prev[slot];
+	} else {
+		vi->mru = vi->prev[slot];
+	}
+}
+
+/**
+ * Index the entry now in slot and make it the MRU one, or free the slot
+ * if the entry is invalid.
+ */
+template <char ST>
+void cache_sim_t::victim_link(uint32_t slot) {
+	const char st = ST ? ST : cache_metadata.block_type;
+	victim_index_t *vi = &cache_metadata.victim_index;
+	cache_entry_t *entry = &cache_metadata.victim_cache[slot];
+	uint32_t bucket;
+
+	if (!entry->valid1 && ((st == BLOCKING) || !entry->valid2)) {
+		vi->free_slots[vi->free_count++] = slot;
+		return;
+	}
+
+	bucket = victim_hash(entry->tag, vi->hash_bits);
+	vi->chain[slot] = vi->buckets[bucket];
+	vi->buckets[bucket] = slot;
+
+	vi->prev[slot] = vi->mru;
+	vi->next[slot] = VICTIM_NONE;
+	if (vi->mru != VICTIM_NONE) {
+		vi->next[vi->mru] = slot;
+	} else {
+		vi->lru = slot;
+	}
+	vi->mru = slot;
+}
+
+/**
+ * Slot for a new victim: a free one if any, else the LRU entry, which is
+ * unlinked and overwritten by the caller.
+ */
+uint32_t cache_sim_t::victim_to_update () {
+	victim_index_t *vi = &cache_metadata.victim_index;
+	uint32_t slot;
+
+	if (vi->free_count) {
+		return vi->free_slots[--vi->free_count];
+	}
+	slot = vi->lru;
+	victim_unlink(slot);
+	return slot;
+}
+
+/*
+ * The access path below is templated on the block type ST, the replacement
+ * policy R and the set associativity WAYS. A zero parameter is read from
+ * cache_metadata at run time instead, so <0, 0, 0> is the generic kernel
+ * and the others let the compiler drop the policy branches and unroll the
+ * way loops. select_kernels() picks the instantiation for a configuration.
+ */
+
+/**
+ * First invalid way of set index, blocks_per_set if the set is full.
+ */
+template <char ST, uint64_t WAYS>
+uint64_t cache_sim_t::first_invalid_way(uint64_t index) const {
+	const char st = ST ? ST : cache_metadata.block_type;
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t word = index * (WAYS ? (WAYS + 63) / 64 : cache_metadata.mask_words);
+
+	if (st == BLOCKING) {
+		return first_invalid(cache_metadata.valid1 + word, NULL, ways);
+	}
+	// subblocking
+	return first_invalid(cache_metadata.valid1 + word, cache_metadata.valid2 + word, ways);
+}
+
+/**
+ * Number of valid ways in set index.
+ */
+template <char ST, uint64_t WAYS>
+uint64_t cache_sim_t::valid_ways(uint64_t index) const {
+	const char st = ST ? ST : cache_metadata.block_type;
+	const uint64_t words = WAYS ? (WAYS + 63) / 64 : cache_metadata.mask_words;
+	uint64_t w, count = 0;
+
+	for (w=0; w<words; w++) {
+		if (st == BLOCKING) {
+			count += __builtin_popcountll(cache_metadata.valid1[index * words + w]);
+		} else {
+			count += __builtin_popcountll(cache_metadata.valid1[index * words + w] |
+			                              cache_metadata.valid2[index * words + w]);
+		}
+	}
+	return count;
+}
+
+template <char ST, uint64_t WAYS>
+uint64_t cache_sim_t::lru_entry_to_update (uint64_t index) {
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t entry;
+
+	// look for an invalid way, else the head of the recency list
+	entry = first_invalid_way<ST, WAYS>(index);
+	if (entry < ways) {
+		return entry;
+	}
+	return cache_metadata.lru_head[index] - 1;
+}
+
+/**
+ * Make way the MRU end of its set's recency list, linking it in if it was
+ * just filled. Links hold way + 1, so a set that was never touched reads
+ * as an empty list and needs no initialization.
+ */
+template <uint64_t WAYS>
+void cache_sim_t::lru_touch(uint64_t index, uint64_t way) {
+	uint64_t base = index * (WAYS ? WAYS : cache_metadata.blocks_per_set);
+	uint32_t *prev = cache_metadata.lru_prev + base;
+	uint32_t *next = cache_metadata.lru_next + base;
+	uint32_t *head = cache_metadata.lru_head + index;
+	uint32_t *tail = cache_metadata.lru_tail + index;
+	uint32_t link = way + 1;
+
+	if (*tail == link) {
+		return;
+	}
+	if (*head == link) {
+		*head = next[way];
+		prev[*head - 1] = LIST_NONE;
+	} else if (prev[way] != LIST_NONE) {
+		next[prev[way] - 1] = next[way];
+		prev[next[way] - 1] = prev[way];
+	}
+
+	prev[way] = *tail;
+	next[way] = LIST_NONE;
+	if (*tail != LIST_NONE) {
+		next[*tail - 1] = link;
+	} else {
+		*head = link;
+	}
+	*tail = link;
+}
+
+/**
+ * The set's FIFO order is a ring starting at fifo_head, so the candidates
+ * are the two oldest ways: the oldest unless it is the MRU one.
+ */
+template <char ST, uint64_t WAYS>
+uint64_t cache_sim_t::nmru_entry_to_update (uint64_t index) {
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t oldest = cache_metadata.fifo_head[index];
+	uint64_t count;
+
+	// the valid ways fill the ring from the oldest on, the next free one
+	// follows the newest
+	count = valid_ways<ST, WAYS>(index);
+	if (count < ways) {
+		return (oldest + count) & (ways - 1);
+	}
+
+	if ((cache_metadata.nmru_reg[index] == 0) || (ways == 1) ||
+	    (cache_metadata.tags[index * ways + oldest] != cache_metadata.nmru_reg[index])) {
+		return oldest;
+	}
+	return (oldest + 1) & (ways - 1);
+}
+
+/**
+ * Copy way from to way to within set index.
+ */
+void cache_sim_t::move_way(uint64_t index, uint64_t from, uint64_t to) {
+	uint64_t base = index * cache_metadata.blocks_per_set;
+	uint64_t *mask = cache_metadata.valid1 + index * cache_metadata.mask_words;
+
+	cache_metadata.tags[base + to] = cache_metadata.tags[base + from];
+	bit_assign(mask, to, bit_test(mask, from));
+	mask = cache_metadata.valid2 + index * cache_metadata.mask_words;
+	bit_assign(mask, to, bit_test(mask, from));
+	mask = cache_metadata.dirty + index * cache_metadata.mask_words;
+	bit_assign(mask, to, bit_test(mask, from));
+	if (cache_metadata.prefetch1) {
+		mask = cache_metadata.prefetch1 + index * cache_metadata.mask_words;
+		bit_assign(mask, to, bit_test(mask, from));
+		mask = cache_metadata.prefetch2 + index * cache_metadata.mask_words;
+		bit_assign(mask, to, bit_test(mask, from));
+	}
+}
+
+template <char ST>
+int cache_sim_t::way_valid(uint64_t index, uint64_t way) const {
+	const char st = ST ? ST : cache_metadata.block_type;
+	uint64_t word = index * cache_metadata.mask_words;
+
+	if (st == BLOCKING) {
+		return bit_test(cache_metadata.valid1 + word, way);
+	}
+	return bit_test(cache_metadata.valid1 + word, way) || bit_test(cache_metadata.valid2 + word, way);
+}
+
+/**
+ * Gather way of set index into a cache_entry_t, whose tag is the block
+ * address rebuilt from the way's tag and the set index.
+ */
+void cache_sim_t::load_entry(uint64_t index, uint64_t way, cache_entry_t *entry) const {
+	uint64_t base = index * cache_metadata.blocks_per_set;
+	uint64_t word = index * cache_metadata.mask_words;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->tag = (cache_metadata.tags[base + way] << cache_metadata.index_size) | index;
+	entry->dirty = bit_test(cache_metadata.dirty + word, way);
+	entry->valid1 = bit_test(cache_metadata.valid1 + word, way);
+	entry->valid2 = bit_test(cache_metadata.valid2 + word, way);
+	if (cache_metadata.prefetch1) {
+		entry->prefetch1 = bit_test(cache_metadata.prefetch1 + word, way);
+		entry->prefetch2 = bit_test(cache_metadata.prefetch2 + word, way);
+	}
+}
+
+/**
+ * Scatter a cache_entry_t into way of set index.
+ */
+void cache_sim_t::store_entry(uint64_t index, uint64_t way, const cache_entry_t *entry) {
+	uint64_t base = index * cache_metadata.blocks_per_set;
+	uint64_t word = index * cache_metadata.mask_words;
+
+	int was = bit_test(cache_metadata.valid1 + word, way) || bit_test(cache_metadata.valid2 + word, way);
+
+	if ((entry->valid1 || entry->valid2) != was) {
+		__atomic_add_fetch(&cache_metadata.valid_lines, was ? (uint64_t) -1 : 1, __ATOMIC_RELAXED);
+	}
+	cache_metadata.tags[base + way] = entry->tag >> cache_metadata.index_size;
+	bit_assign(cache_metadata.dirty + word, way, entry->dirty);
+	bit_assign(cache_metadata.valid1 + word, way, entry->valid1);
+	bit_assign(cache_metadata.valid2 + word, way, entry->valid2);
+	if (cache_metadata.prefetch1) {
+		bit_assign(cache_metadata.prefetch1 + word, way, entry->prefetch1);
+		bit_assign(cache_metadata.prefetch2 + word, way, entry->prefetch2);
+	}
+}
+
+/**
+ * Take entry out of the FIFO order and return the way that becomes its
+ * newest slot. Evicting the oldest way just advances the ring; evicting
+ * the second oldest first moves the oldest into its place.
+ */
+template <char ST, uint64_t WAYS>
+uint64_t cache_sim_t::nmru_push_entry (uint64_t index, uint64_t entry) {
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t oldest = cache_metadata.fifo_head[index];
+
+	if (!way_valid<ST>(index, entry)) {
+		return entry;
+	}
+
+	if (entry != oldest) {
+		move_way(index, oldest, entry);
+	}
+	cache_metadata.fifo_head[index] = (oldest + 1) & (ways - 1);
+	return oldest;
+}
+
+/**
+ * Main cache half of an access. Only touches the set at index, so accesses
+ * to different sets can run on different threads.
+ *
+ * @ev Filled in on a miss: the replaced entry, which the victim stage takes.
+ *     Either way ev->index and ev->way locate the accessed block.
+ * @return 1 if the access hit the main cache
+ */
+template <char ST, char R, uint64_t WAYS>
+int cache_sim_t::main_kernel(char rw, uint64_t address, cache_stats_t* p_stats, uint64_t tag,
+				uint64_t index, uint64_t block_offset, victim_event_t *ev) {
+	const char st = ST ? ST : cache_metadata.block_type;
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t i, n, base, word, entry_to_evict, hits = 0;
+	uint8_t found = 0, found_other_half = 0;
+
+	p_stats->accesses++;
+
+	if (rw == READ) {
+		p_stats->reads++;
+	} else {
+		p_stats->writes++;
+		if (write_policy == WRITE_THROUGH) {
+			p_stats->bytes_written += STORE_BYTES;
+		}
+	}
+
+	// First search in the cache. If found, return.
+	base = index * ways;
+	word = index * (WAYS ? (WAYS + 63) / 64 : cache_metadata.mask_words);
+	for (i=0; i<ways; i+=64) {
+		n = ((ways - i) < 64) ? (ways - i) : 64;
+		hits = match_tags(cache_metadata.tags + base + i, n, tag);
+		if (st == BLOCKING) {
+			hits &= cache_metadata.valid1[word + i/64];
+		} else {
+			// sub blocking, either half makes it a hit in this line
+			hits &= cache_metadata.valid1[word + i/64] | cache_metadata.valid2[word + i/64];
+		}
+		if (hits) {
+			break;
+		}
+	}
+
+	if (hits) {
+		i += __builtin_ctzll(hits);
+		if (st == BLOCKING) {
+			found = 1;
+		} else if (block_offset < (cache_metadata.cacheline_size/2)) {
+			found = bit_test(cache_metadata.valid1 + word, i);
+			found_other_half = !found;
+		} else {
+			found = bit_test(cache_metadata.valid2 + word, i);
+			found_other_half = !found;
+		}
+
+		if (found && cache_metadata.prefetch1) {
+			uint64_t *pf = ((st == BLOCKING) || (block_offset < (cache_metadata.cacheline_size/2))) ?
+			               cache_metadata.prefetch1 : cache_metadata.prefetch2;
+			if (bit_test(pf + word, i)) {
+				p_stats->prefetch_useful++;
+				bit_assign(pf + word, i, 0);
+			}
+		}
+
+		// data found. update Stats and return.
+		replacement<R>::template hit<WAYS>(this, index, i, tag);
+		if ((rw == WRITE) && (write_policy == WRITE_BACK)) {
+			bit_assign(cache_metadata.dirty + word, i, 1);
+		}
+		if (found_other_half) {
+			// Missed main cache and victim cache
+			if (rw == READ) {
+				p_stats->read_misses++;
+				p_stats->read_misses_combined++;
+			} else {
+				p_stats->write_misses++;
+				p_stats->write_misses_combined++;
+			}
+			//load the other half from memory and mark both valid :)
+			p_stats->bytes_read += cache_metadata.cacheline_size/2;
+			bit_assign(cache_metadata.valid1 + word, i, 1);
+			bit_assign(cache_metadata.valid2 + word, i, 1);
+		}
+		ev->index = index;
+		ev->way = i;
+		return 1;
+	}
+
+	// Missed main cache
+	if (rw == READ) {
+		p_stats->read_misses++;
+	} else {
+		p_stats->write_misses++;
+		if ((allocate_policy == NO_WRITE_ALLOCATE) &&
+		    (victim_find(address >> cache_metadata.block_offset_size) == VICTIM_NONE)) {
+			// the store goes around both caches and leaves the set alone
+			memset(&ev->evicted, 0, sizeof(ev->evicted));
+			ev->index = index;
+			ev->way = NO_WAY;
+			return 0;
+		}
+	}
+
+	entry_to_evict = replacement<R>::template victim<ST, WAYS>(this, index);
+	load_entry(index, entry_to_evict, &ev->evicted);
+	entry_to_evict = replacement<R>::template evict<ST, WAYS>(this, index, entry_to_evict);
+	ev->index = index;
+	ev->way = entry_to_evict;
+
+	// fill the entry from memory, the victim stage may replace it
+	cache_metadata.tags[base + entry_to_evict] = tag;
+	if (!ev->evicted.valid1 && !ev->evicted.valid2) {
+		__atomic_add_fetch(&cache_metadata.valid_lines, 1, __ATOMIC_RELAXED);
+	}
+
+	if (st == BLOCKING) {
+		bit_assign(cache_metadata.valid1 + word, entry_to_evict, 1);
+	} else {
+		if (block_offset < (cache_metadata.cacheline_size/2)) {
+			bit_assign(cache_metadata.valid1 + word, entry_to_evict, 1);
+			bit_assign(cache_metadata.valid2 + word, entry_to_evict, 0);
+		} else {
+			bit_assign(cache_metadata.valid2 + word, entry_to_evict, 1);
+			bit_assign(cache_metadata.valid1 + word, entry_to_evict, 0);
+		}
+	}
+
+	bit_assign(cache_metadata.dirty + word, entry_to_evict,
+	           (rw == WRITE) && (write_policy == WRITE_BACK));
+	if (cache_metadata.prefetch1) {
+		bit_assign(cache_metadata.prefetch1 + word, entry_to_evict, 0);
+		bit_assign(cache_metadata.prefetch2 + word, entry_to_evict, 0);
+	}
+
+	replacement<R>::template fill<WAYS>(this, index, entry_to_evict, tag, address);
+	return 0;
+}
+
+/**
+ * Victim cache half of a main cache miss. The victim cache is shared by all
+ * sets, so this runs in global access order.
+ *
+ * @ev The miss from main_lookup. With ev->entry set, a victim hit also
+ *     moves the victim's copy of the block into the main cache entry.
+ */
+template <char ST>
+void cache_sim_t::victim_kernel(const victim_event_t *ev, cache_stats_t* p_stats) {
+	const char st = ST ? ST : cache_metadata.block_type;
+	uint32_t i, vict_entry;
+	char rw = ev->rw;
+	uint64_t address = ev->address;
+	uint64_t vict_tag = address >> (cache_metadata.block_offset_size);
+	uint64_t block_offset = address & (cache_metadata.cacheline_size - 1);
+	cache_entry_t hit, evicted = ev->evicted;
+	uint8_t found = 0, found_other_half = 0;
+	uint8_t invalid_entry = 0;
+
+	if (!pending_dirty.empty() && (evicted.valid1 || evicted.valid2) &&
+	    pending_dirty.erase(evicted.tag)) {
+		evicted.dirty = 1;
+	}
+
+	// data not found in cache. Look in victim cache
+	i = victim_find(vict_tag);
+	if (i != VICTIM_NONE) {
+		if (st == BLOCKING) {
+			found = 1;
+		} else if (block_offset < (cache_metadata.cacheline_size/2)) {
+			found = cache_metadata.victim_cache[i].valid1;
+			found_other_half = !found;
+		} else {
+			found = cache_metadata.victim_cache[i].valid2;
+			found_other_half = !found;
+		}
+
+		// found entry. swap entry
+		hit = cache_metadata.victim_cache[i];
+		if (found && (hit.prefetch1 || hit.prefetch2)) {
+			if ((st == BLOCKING) || (block_offset < (cache_metadata.cacheline_size/2))) {
+				p_stats->prefetch_useful += hit.prefetch1;
+				hit.prefetch1 = 0;
+			} else {
+				p_stats->prefetch_useful += hit.prefetch2;
+				hit.prefetch2 = 0;
+			}
+		}
+		victim_unlink(i);
+		cache_metadata.victim_cache[i] = evicted;
+		victim_link<ST>(i);
+
+		if (found_other_half) {
+			// Missed main cache and victim cache
+			if (rw == READ) {
+				p_stats->read_misses_combined++;
+			} else {
+				p_stats->write_misses_combined++;
+			}
+			//load the other half from memory and mark both valid :)
+			p_stats->bytes_read += cache_metadata.cacheline_size/2;
+			hit.valid1 = 1;
+			hit.valid2 = 1;
+		}
+		if ((rw == WRITE) && (write_policy == WRITE_BACK)) {
+			hit.dirty = 1;
+		}
+		if (ev->way != NO_WAY) {
+			store_entry(ev->index, ev->way, &hit);
+		} else if (hit.dirty && (rw == READ)) {
+			// sharded, the set has moved on; the main stage filled it clean
+			pending_dirty.insert(hit.tag);
+		}
+		return;
+	}
+
+	// Missed main cache
+	if (rw == READ) {
+		p_stats->read_misses_combined++;
+	} else {
+		p_stats->write_misses_combined++;
+	}
+
+	if ((rw == WRITE) && (allocate_policy == NO_WRITE_ALLOCATE)) {
+		// written around, nothing was filled or evicted
+		if (write_policy == WRITE_BACK) {
+			p_stats->bytes_written += STORE_BYTES;
+		}
+		return;
+	}
+	p_stats->bytes_read += (st == BLOCKING) ? cache_metadata.cacheline_size :
+	                                          cache_metadata.cacheline_size/2;
+
+	if (st == BLOCKING) {
+		if (!(evicted.valid1)) {
+			invalid_entry = 1;
+		}
+	} else {
+		if ((!(evicted.valid1)) && (!(evicted.valid2))) {
+			invalid_entry = 1;
+		}
+	}
+
+	if (!invalid_entry) {
+		// not in victim cache too. Move entry to victim cache first.
+		vict_entry = victim_to_update();
+		if (drop_out) {
+			// whatever held the slot leaves this cache for good
+			*drop_out = cache_metadata.victim_cache[vict_entry];
+		}
+
+		// evict victim, need to write to memory if dirty
+		write_back(&cache_metadata.victim_cache[vict_entry], p_stats);
+		p_stats->prefetch_useless += cache_metadata.victim_cache[vict_entry].prefetch1 +
+		                             cache_metadata.victim_cache[vict_entry].prefetch2;
+		cache_metadata.victim_cache[vict_entry] = evicted;
+		victim_link<ST>(vict_entry);
+	}
+}
+
+/**
+ * Repeat access to the block the previous access left at (last_index,
+ * last_way). The tag search is skipped, but the hit is counted, the dirty
+ * bit set and the replacement policy told of the hit, exactly what the
+ * full lookup would do. For LRU, NMRU_FIFO and tree PLRU the hit repeats
+ * what the previous access did already; RRIP and SHiP promote a line on
+ * its first hit after the fill. With SUBBLOCKING the accessed half must be
+ * valid as well.
+ *
+ * @return 0 if the access needs the full lookup
+ */
+template <char ST, char R, uint64_t WAYS>
+int cache_sim_t::fast_hit(char rw, uint64_t address, cache_stats_t* p_stats) {
+	const char st = ST ? ST : cache_metadata.block_type;
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	uint64_t word = last_index * cache_metadata.mask_words;
+	uint64_t *half;
+
+	if (st != BLOCKING) {
+		half = ((address & (cache_metadata.cacheline_size - 1)) < (cache_metadata.cacheline_size/2)) ?
+		       cache_metadata.valid1 : cache_metadata.valid2;
+		if (!bit_test(half + word, last_way)) {
+			return 0;
+		}
+		// the first use of a prefetched half is counted on the full path
+		if (cache_metadata.prefetch1 &&
+		    bit_test(((half == cache_metadata.valid1) ? cache_metadata.prefetch1 :
+		              cache_metadata.prefetch2) + word, last_way)) {
+			return 0;
+		}
+	}
+
+	++logical_clock;
+	replacement<R>::template hit<WAYS>(this, last_index, last_way,
+	                                   cache_metadata.tags[last_index * ways + last_way]);
+	p_stats->accesses++;
+	p_stats->fast_hits++;
+	if (rw == READ) {
+		p_stats->reads++;
+	} else {
+		p_stats->writes++;
+		if (write_policy == WRITE_BACK) {
+			bit_assign(cache_metadata.dirty + word, last_way, 1);
+		} else {
+			p_stats->bytes_written += STORE_BYTES;
+		}
+	}
+	if (classifier) {
+		classifier->record(address, last_index, 1, 0, 0, p_stats);
+	}
+	return 1;
+}
+
+/**
+ * The unit a fill brings in: a line, or half of one when SUBBLOCKING.
+ */
+static inline uint64_t fill_unit(uint64_t address, uint64_t b, char st) {
+	return (st == BLOCKING || b == 0) ? address >> b : address >> (b - 1);
+}
+
+/**
+ * Whether the data at address is in the main or the victim cache, only
+ * its half of the line when SUBBLOCKING.
+ */
+int cache_sim_t::cached(uint64_t address) const {
+	uint64_t tag, index, block_offset, way, word;
+	uint32_t slot;
+	int lower;
+
+	decode_address(address, &tag, &index, &block_offset);
+	word = index * cache_metadata.mask_words;
+	lower = (cache_metadata.block_type == BLOCKING) || (block_offset < cache_metadata.cacheline_size/2);
+	way = find_way(index, tag);
+	if (way != NO_WAY) {
+		return bit_test((lower ? cache_metadata.valid1 : cache_metadata.valid2) + word, way);
+	}
+	slot = victim_find(address >> cache_metadata.block_offset_size);
+	if (slot != VICTIM_NONE) {
+		return lower ? cache_metadata.victim_cache[slot].valid1 : cache_metadata.victim_cache[slot].valid2;
+	}
+	return 0;
+}
+
+/**
+ * Queue a prefetch of address, unless it is cached or in flight already.
+ * @return 0, or -1 if the queue was full and the prefetch dropped
+ */
+int cache_sim_t::prefetch_enqueue(uint64_t address, cache_stats_t* p_stats) {
+	uint64_t b = cache_metadata.block_offset_size;
+	char st = cache_metadata.block_type;
+	uint64_t unit = fill_unit(address, b, st);
+	prefetch_slot_t *slot;
+	uint64_t k;
+
+	if (cached(address)) {
+		return 0;
+	}
+	for (k=0; k<prefetch_count; k++) {
+		slot = &prefetch_queue[(prefetch_head + k) % PREFETCH_QUEUE];
+		if (slot->live && (fill_unit(slot->address, b, st) == unit)) {
+			return 0;
+		}
+	}
+	if (prefetch_count == PREFETCH_QUEUE) {
+		p_stats->prefetch_dropped++;
+		return -1;
+	}
+	slot = &prefetch_queue[(prefetch_head + prefetch_count++) % PREFETCH_QUEUE];
+	slot->address = address;
+	slot->ready = logical_clock + PREFETCH_DELAY;
+	slot->live = 1;
+	return 0;
+}
+
+/**
+ * Bring the line or half holding address in like a read miss would, but
+ * outside the demand counters, and tag it as prefetched. Whatever the fill
+ * pushes out of the victim cache goes into the pollution filter.
+ */
+void cache_sim_t::prefetch_fill(uint64_t address, cache_stats_t* p_stats) {
+	const uint64_t half = cache_metadata.cacheline_size/2;
+	uint64_t tag, index, block_offset, way, word;
+	cache_entry_t *saved = drop_out, dropped;
+	cache_stats_t scratch;
+	victim_event_t ev;
+	uint64_t *pf;
+	int lower;
+
+	decode_address(address, &tag, &index, &block_offset);
+	word = index * cache_metadata.mask_words;
+	lower = (cache_metadata.block_type == BLOCKING) || (block_offset < half);
+	way = find_way(index, tag);
+	if (way != NO_WAY) {
+		if (bit_test((lower ? cache_metadata.valid1 : cache_metadata.valid2) + word, way)) {
+			p_stats->prefetch_dropped++;
+			return;
+		}
+		// the line is here, only the other half is missing
+		bit_assign((lower ? cache_metadata.valid1 : cache_metadata.valid2) + word, way, 1);
+		bit_assign((lower ? cache_metadata.prefetch1 : cache_metadata.prefetch2) + word, way, 1);
+		p_stats->bytes_read += half;
+		p_stats->prefetches++;
+		return;
+	}
+	if (victim_find(address >> cache_metadata.block_offset_size) != VICTIM_NONE) {
+		// in the victim cache, or only its other half is; leave it to demand
+		p_stats->prefetch_dropped++;
+		return;
+	}
 
-	cache_metadata.cache = (cache_entry_t **) malloc(sizeof(cache_entry_t *) * cache_metadata.total_sets);
+	memset(&scratch, 0, sizeof(scratch));
+	memset(&dropped, 0, sizeof(dropped));
+	drop_out = &dropped;
+	(this->*kernel.main)(READ, address, &scratch, tag, index, block_offset, &ev);
+	ev.rw = READ;
+	ev.address = address;
+	(this->*kernel.victim)(&ev, &scratch);
+	drop_out = saved;
 
-	for (i=0; i<cache_metadata.total_sets; i++) {
-		cache_metadata.cache[i] = (cache_entry_t *) malloc((sizeof(cache_entry_t)) *
-				                          cache_metadata.blocks_per_set);
-		memset(cache_metadata.cache[i], 0, (sizeof(cache_entry_t) * cache_metadata.blocks_per_set));
+	pf = lower ? cache_metadata.prefetch1 : cache_metadata.prefetch2;
+	bit_assign(pf + word, ev.way, 1);
+	if (dropped.valid1 || dropped.valid2) {
+		cache_metadata.pollution[dropped.tag & (POLLUTION_FILTER - 1)] = dropped.tag + 1;
 	}
+	p_stats->prefetches++;
+	p_stats->bytes_read += scratch.bytes_read;
+	p_stats->bytes_written += scratch.bytes_written;
+	p_stats->writebacks += scratch.writebacks;
+	p_stats->prefetch_useless += scratch.prefetch_useless;
+	// the fill may have moved the block the fast path points at
+	last_way = NO_WAY;
+}
 
-	cache_metadata.victim_cache = (cache_entry_t *) malloc(((sizeof(cache_entry_t)) *
-				                           cache_metadata.victim_blocks));
-	memset(cache_metadata.victim_cache, 0, (sizeof(cache_entry_t) * cache_metadata.victim_blocks));
+/**
+ * Fill the prefetches whose data has arrived by now.
+ */
+void cache_sim_t::prefetch_arrive(cache_stats_t* p_stats) {
+	prefetch_slot_t *slot;
 
-	if (cache_metadata.replacement_policy == NMRU_FIFO) {
-		cache_metadata.nmru_reg = (uint64_t *) malloc(sizeof(uint64_t) * cache_metadata.total_sets);
-		for (i=0; i<cache_metadata.total_sets; i++) {
-			cache_metadata.nmru_reg[i] = 0;
+	while (prefetch_count) {
+		slot = &prefetch_queue[prefetch_head];
+		if (slot->ready > logical_clock) {
+			return;
+		}
+		if (slot->live) {
+			prefetch_fill(slot->address, p_stats);
 		}
+		prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE;
+		prefetch_count--;
 	}
 }
 
-uint64_t victim_to_update () {
-	uint64_t entry, lru = 0, lru_entry = 0;
+/**
+ * Let the prefetcher see a demand access that missed, or that was the
+ * first use of a prefetched line, and queue what it predicts next.
+ */
+void cache_sim_t::prefetch_train(uint64_t address, int missed, int useful, cache_stats_t* p_stats) {
+	const uint64_t b = cache_metadata.block_offset_size;
+	const char st = cache_metadata.block_type;
+	const uint64_t shift = (st == BLOCKING || b == 0) ? b : b - 1;
+	uint64_t block = address >> b, unit = address >> shift;
+	uint64_t *filter = cache_metadata.pollution + (block & (POLLUTION_FILTER - 1));
+	prefetch_stream_t *stream = NULL;
+	prefetch_slot_t *slot;
+	int64_t delta;
+	uint64_t k, ticks, lead;
 
-	// look for LRU
-	for (entry=0; entry<cache_metadata.victim_blocks; entry++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if (!cache_metadata.victim_cache[entry].valid1) {
-				return entry;
-			}
-		} else {
-			if ((!cache_metadata.victim_cache[entry].valid1) && 
-				(!cache_metadata.victim_cache[entry].valid2)) {
-				return entry;
+	if (missed) {
+		// a prefetch of this data was issued, just not early enough
+		for (k=0; k<prefetch_count; k++) {
+			slot = &prefetch_queue[(prefetch_head + k) % PREFETCH_QUEUE];
+			if (slot->live && (fill_unit(slot->address, b, st) == unit)) {
+				p_stats->prefetch_late++;
+				slot->live = 0;
 			}
 		}
-		if (lru == 0) {
-			lru = cache_metadata.victim_cache[entry].clock_data.time_lru;
-			lru_entry = entry;
-		} else {
-			if (lru > cache_metadata.victim_cache[entry].clock_data.time_lru) {
-				lru = cache_metadata.victim_cache[entry].clock_data.time_lru;
-				lru_entry = entry;
-			}
+		if (*filter == block + 1) {
+			p_stats->prefetch_pollution++;
+			*filter = 0;
 		}
+	} else if (!useful) {
+		return;
 	}
-	return lru_entry;
-}
 
-uint64_t lru_entry_to_update (uint64_t index) {
-	uint64_t entry, lru = 0, lru_entry = 0;
-
-	// look for LRU
-	for (entry=0; entry<cache_metadata.blocks_per_set; entry++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if (!(cache_metadata.cache[index]+entry)->valid1) {
-				return entry;
+	if (prefetcher == PREFETCH_NEXT_LINE) {
+		prefetch_enqueue(address + cache_metadata.cacheline_size, p_stats);
+	} else if (prefetcher == PREFETCH_HALF) {
+		if ((st == SUBBLOCKING) && missed) {
+			prefetch_enqueue(address ^ (cache_metadata.cacheline_size/2), p_stats);
+		}
+	} else if (prefetcher == PREFETCH_STRIDE) {
+		// streams run over fill units; extend the nearest one within reach,
+		// else replace the stalest
+		for (k=0; k<PREFETCH_STREAMS; k++) {
+			delta = unit - streams[k].last;
+			if (streams[k].used && delta && (delta >= -PREFETCH_WINDOW) &&
+			    (delta <= PREFETCH_WINDOW)) {
+				if (!stream || (llabs(delta) < llabs((int64_t) (unit - stream->last)))) {
+					stream = &streams[k];
+				}
 			}
-		} else {
-			// subblocking
-			if ((!(cache_metadata.cache[index]+entry)->valid1) &&
-			    (!(cache_metadata.cache[index]+entry)->valid2)) {
-				return entry;
+		}
+		if (!stream) {
+			stream = &streams[0];
+			for (k=1; k<PREFETCH_STREAMS; k++) {
+				if (streams[k].used < stream->used) {
+					stream = &streams[k];
+				}
 			}
+			stream->last = unit;
+			stream->stride = 0;
+			stream->confirmed = 0;
+			stream->used = logical_clock;
+			stream->ahead = 0;
+			return;
 		}
-
-		if (lru == 0) {
-			lru = (cache_metadata.cache[index]+entry)->clock_data.time_lru;
-			lru_entry = entry;
+		delta = unit - stream->last;
+		ticks = logical_clock - stream->used;
+		if (delta == stream->stride) {
+			stream->confirmed++;
+			stream->ahead -= (stream->ahead > 0);
 		} else {
-			if (lru > (cache_metadata.cache[index]+entry)->clock_data.time_lru) {
-				lru = (cache_metadata.cache[index]+entry)->clock_data.time_lru;
-				lru_entry = entry;
+			stream->stride = delta;
+			stream->confirmed = 0;
+			stream->ahead = 0;
+		}
+		stream->last = unit;
+		stream->used = logical_clock;
+		if (stream->confirmed) {
+			// anything closer than the strides demand covers in PREFETCH_DELAY
+			// accesses arrives late; queue from there, past the frontier, as
+			// many lines further whatever the fill unit
+			lead = (PREFETCH_DELAY + (ticks ? ticks : 1) - 1) / (ticks ? ticks : 1);
+			k = (stream->ahead >= lead) ? stream->ahead + 1 : lead;
+			for (; k<=lead + ((uint64_t) PREFETCH_DEGREE << (b - shift)); k++) {
+				if (prefetch_enqueue((unit + stream->stride * (int64_t) k) << shift, p_stats) < 0) {
+					break;
+				}
+				stream->ahead = k;
 			}
 		}
 	}
-	return lru_entry;
 }
 
-uint64_t nmru_entry_to_update (uint64_t index) {
-	uint64_t entry, lru_entry = 0;
-	uint64_t found = 0;
+/**
+ * One whole access: decode, main cache, then the victim cache on a miss.
+ */
+template <char ST, char R, uint64_t WAYS>
+void cache_sim_t::access_kernel(char rw, uint64_t address, cache_stats_t* p_stats) {
+	uint64_t block_offset;
+	uint64_t index, tag, misses, useful;
+	victim_event_t ev;
+	int hit, missed;
 
-	// look for NMRU
-	for (entry=0; entry<cache_metadata.blocks_per_set; entry++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if (!(cache_metadata.cache[index]+entry)->valid1) {
-				return entry;
-			}
-		} else {
-			// subblocking
-			if ((!(cache_metadata.cache[index]+entry)->valid1) &&
-			    (!(cache_metadata.cache[index]+entry)->valid2)) {
-				return entry;
+	if (prefetch_count) {
+		prefetch_arrive(p_stats);
+	}
+	if (((address >> cache_metadata.block_offset_size) == last_block) && (last_way != NO_WAY) &&
+	    fast_hit<ST, R, WAYS>(rw, address, p_stats)) {
+		return;
+	}
+
+	// retrieve block Offset, Index and Tag from the address
+	decode_address(address, &tag, &index, &block_offset);
+
+	++logical_clock;
+
+	misses = p_stats->read_misses_combined + p_stats->write_misses_combined;
+	useful = p_stats->prefetch_useful;
+	hit = main_kernel<ST, R, WAYS>(rw, address, p_stats, tag, index, block_offset, &ev);
+	if (!hit) {
+		ev.rw = rw;
+		ev.address = address;
+		victim_kernel<ST>(&ev, p_stats);
+	}
+	last_block = address >> cache_metadata.block_offset_size;
+	last_index = ev.index;
+	last_way = ev.way;
+	missed = (misses != p_stats->read_misses_combined + p_stats->write_misses_combined);
+	if (prefetcher != PREFETCH_NONE) {
+		prefetch_train(address, missed, useful != p_stats->prefetch_useful, p_stats);
+	}
+	if (classifier) {
+		classifier->record(address, index, hit, missed,
+		                   !hit && (ev.evicted.valid1 || ev.evicted.valid2), p_stats);
+	}
+}
+
+/**
+ * A run of accesses, simulated in order. Each group of BATCH_AHEAD is
+ * decoded first and the sets it touches prefetched, so the host cache
+ * misses of a large tag store overlap instead of stalling one at a time.
+ */
+template <char ST, char R, uint64_t WAYS>
+void cache_sim_t::batch_kernel(const access_t *accesses, size_t n, cache_stats_t* p_stats) {
+	const char st = ST ? ST : cache_metadata.block_type;
+	const uint64_t ways = WAYS ? WAYS : cache_metadata.blocks_per_set;
+	const uint64_t words = WAYS ? (WAYS + 63) / 64 : cache_metadata.mask_words;
+	uint64_t tag[BATCH_AHEAD], index[BATCH_AHEAD], block_offset[BATCH_AHEAD];
+	uint64_t misses, useful;
+	victim_event_t ev;
+	size_t i, j, m;
+	int hit, missed;
+
+	for (i=0; i<n; i+=m) {
+		m = ((n - i) < BATCH_AHEAD) ? (n - i) : BATCH_AHEAD;
+		for (j=0; j<m; j++) {
+			decode_address(accesses[i + j].address, &tag[j], &index[j], &block_offset[j]);
+			__builtin_prefetch(cache_metadata.tags + index[j] * ways);
+			__builtin_prefetch(cache_metadata.valid1 + index[j] * words);
+			if (st != BLOCKING) {
+				__builtin_prefetch(cache_metadata.valid2 + index[j] * words);
 			}
+			replacement<R>::template prefetch<WAYS>(&cache_metadata, index[j]);
 		}
+		for (j=0; j<m; j++) {
+			const access_t *acc = &accesses[i + j];
 
-		if ((!found) && (cache_metadata.nmru_reg[index] != 0) &&
-			(cache_metadata.nmru_reg[index] != (cache_metadata.cache[index]+entry)->tag)) {
-			found = 1;
-			lru_entry = entry;
+			if (prefetch_count) {
+				prefetch_arrive(p_stats);
+			}
+			if (((acc->address >> cache_metadata.block_offset_size) == last_block) &&
+			    (last_way != NO_WAY) && fast_hit<ST, R, WAYS>(acc->rw, acc->address, p_stats)) {
+				continue;
+			}
+
+			++logical_clock;
+			misses = p_stats->read_misses_combined + p_stats->write_misses_combined;
+			useful = p_stats->prefetch_useful;
+			hit = main_kernel<ST, R, WAYS>(acc->rw, acc->address, p_stats, tag[j], index[j],
+			                               block_offset[j], &ev);
+			if (!hit) {
+				ev.rw = acc->rw;
+				ev.address = acc->address;
+				victim_kernel<ST>(&ev, p_stats);
+			}
+			last_block = acc->address >> cache_metadata.block_offset_size;
+			last_index = ev.index;
+			last_way = ev.way;
+			missed = (misses != p_stats->read_misses_combined + p_stats->write_misses_combined);
+			if (prefetcher != PREFETCH_NONE) {
+				prefetch_train(acc->address, missed, useful != p_stats->prefetch_useful, p_stats);
+			}
+			if (classifier) {
+				classifier->record(acc->address, index[j], hit, missed,
+				                   !hit && (ev.evicted.valid1 || ev.evicted.valid2), p_stats);
+			}
 		}
 	}
-	return lru_entry;
 }
 
-uint64_t nmru_push_entry (uint64_t index, uint64_t entry) {
-	uint64_t i;
+#define KERNEL(ST, R, WAYS) { &cache_sim_t::access_kernel<ST, R, WAYS>, \
+                              &cache_sim_t::main_kernel<ST, R, WAYS>, \
+                              &cache_sim_t::victim_kernel<ST>, \
+                              &cache_sim_t::batch_kernel<ST, R, WAYS> }
+#define KERNEL_ROW(ST, R) { KERNEL(ST, R, 0), KERNEL(ST, R, 1), KERNEL(ST, R, 2), \
+                            KERNEL(ST, R, 4), KERNEL(ST, R, 8), KERNEL(ST, R, 16) }
+#define KERNEL_PLANE(ST) { KERNEL_ROW(ST, LRU), KERNEL_ROW(ST, NMRU_FIFO), \
+                           KERNEL_ROW(ST, TREE_PLRU), KERNEL_ROW(ST, SRRIP), \
+                           KERNEL_ROW(ST, BRRIP), KERNEL_ROW(ST, DRRIP), KERNEL_ROW(ST, SHIP) }
 
-	if (cache_metadata.block_type == BLOCKING) {
-		if (!((cache_metadata.cache[index]+entry)->valid1)) {
-			return entry;
-		}
-	} else {
-		if ((!(cache_metadata.cache[index]+entry)->valid1) &&
-		    (!(cache_metadata.cache[index]+entry)->valid2)) {
-			return entry;
-		}
+/**
+ * Point the access path at the kernel specialized for the configuration
+ * set up last, or at the generic one, which benchmarks compare against.
+ */
+void cache_sim_t::select_kernels(int generic) {
+	static const char policies[] = { LRU, NMRU_FIFO, TREE_PLRU, SRRIP, BRRIP, DRRIP, SHIP };
+	// [subblocking][position in policies][log2 ways + 1, 0 for wider sets]
+	static const kernel_set_t kernels[2][sizeof(policies)][6] = {
+		KERNEL_PLANE(BLOCKING),
+		KERNEL_PLANE(SUBBLOCKING),
+	};
+	static const kernel_set_t generic_kernel = KERNEL(0, 0, 0);
+	const size_t count = sizeof(policies) / sizeof(policies[0]);
+	uint64_t ways = cache_metadata.blocks_per_set;
+	size_t w = 0, p = 0;
+
+	if (generic || (ways == 0)) {
+		kernel = generic_kernel;
+		return;
+	}
+	if (ways <= 16) {
+		w = 1 + __builtin_ctzll(ways);
+	}
+	while ((p < count) && (policies[p] != cache_metadata.replacement_policy)) {
+		p++;
 	}
+	if (p == count) {
+		fprintf(stderr, "no kernel for replacement policy %c\n", cache_metadata.replacement_policy);
+		exit(1);
+	}
+	kernel = kernels[cache_metadata.block_type == SUBBLOCKING][p][w];
+}
 
-	for (i = entry; i<cache_metadata.blocks_per_set-1; i++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if ((cache_metadata.cache[index]+(i+1))->valid1) {
-				*(cache_metadata.cache[index]+i) = *(cache_metadata.cache[index]+(i+1));
-				(cache_metadata.cache[index]+(i+1))->valid1 = 0;
-			} else {
-			    return i+1;
-			}
-		} else {
-			if (((cache_metadata.cache[index]+(i+1))->valid1) ||
-			    ((cache_metadata.cache[index]+(i+1))->valid2)) {
-				*(cache_metadata.cache[index]+i) = *(cache_metadata.cache[index]+(i+1));
-				(cache_metadata.cache[index]+(i+1))->valid1 = 0;
-				(cache_metadata.cache[index]+(i+1))->valid2 = 0;
-			} else {
-			    return i+1;
-			}
+int cache_sim_t::main_lookup(char rw, uint64_t address, cache_stats_t* p_stats, uint64_t tag,
+				uint64_t index, uint64_t block_offset, victim_event_t *ev) {
+	return (this->*kernel.main)(rw, address, p_stats, tag, index, block_offset, ev);
+}
+
+void cache_sim_t::victim_lookup(const victim_event_t *ev, cache_stats_t* p_stats) {
+	(this->*kernel.victim)(ev, p_stats);
+}
+
+/**
+ * Subroutine that simulates the cache one trace event at a time.
+ * XXX: You're responsible for completing this routine
+ *
+ * @rw The type of event. Either READ or WRITE
+ * @address  The target memory address
+ * @p_stats Pointer to the statistics structure
+ */
+void cache_sim_t::cache_access(char rw, uint64_t address, cache_stats_t* p_stats) {
+	(this->*kernel.access)(rw, address, p_stats);
+}
+
+/**
+ * Same as n calls to cache_access, with the decoding and the loads of the
+ * sets the accesses touch hoisted ahead of the simulation.
+ */
+void cache_sim_t::cache_access_batch(const access_t *accesses, size_t n, cache_stats_t* p_stats) {
+	(this->*kernel.batch)(accesses, n, p_stats);
+}
+
+void cache_sim_t::decode_address(uint64_t address, uint64_t *tag, uint64_t *index,
+                                 uint64_t *block_offset) const {
+	*tag = address >> (cache_metadata.block_offset_size + cache_metadata.index_size);
+
+	*index = (((uint64_t) 1 << (cache_metadata.index_size + cache_metadata.block_offset_size)) - 1);
+	*index = address & *index;
+	*index = *index >> (cache_metadata.block_offset_size);
+
+	*block_offset = (((uint64_t) 1 << (cache_metadata.block_offset_size)) - 1);
+	*block_offset = address & *block_offset;
+}
+
+/**
+ * Way of set index holding tag in either half, NO_WAY if none does.
+ */
+uint64_t cache_sim_t::find_way(uint64_t index, uint64_t tag) const {
+	uint64_t ways = cache_metadata.blocks_per_set;
+	uint64_t word = index * cache_metadata.mask_words;
+	uint64_t i, n, hits;
+
+	for (i=0; i<ways; i+=64) {
+		n = ((ways - i) < 64) ? (ways - i) : 64;
+		hits = match_tags(cache_metadata.tags + index * ways + i, n, tag) &
+		       (cache_metadata.valid1[word + i/64] | cache_metadata.valid2[word + i/64]);
+		if (hits) {
+			return i + __builtin_ctzll(hits);
 		}
 	}
-	return i;
+	return NO_WAY;
 }
 
-void read_write(char rw, uint64_t address, cache_stats_t* p_stats, uint64_t tag, 
-				uint64_t index, uint64_t block_offset) {
-	uint64_t i, entry_to_evict, vict_entry, temp_tag;
-	cache_entry_t temp;
-	uint64_t vict_tag = address >> (cache_metadata.block_offset_size);
-	uint8_t found = 0, found_other_half = 0;
-	uint8_t invalid_entry = 0;
+/**
+ * Functional warming: update the main cache's tags and replacement state
+ * for an access, without counting it or running the victim stage. Lines
+ * it pushes out are dropped. A block in the victim cache takes the full
+ * path instead, so it never ends up in both caches.
+ */
+void cache_sim_t::warm_access(char rw, uint64_t address) {
+	uint64_t tag, index, block_offset;
+	cache_stats_t scratch;
+	victim_event_t ev;
 
+	memset(&scratch, 0, sizeof(scratch));
+	if (victim_find(address >> cache_metadata.block_offset_size) != VICTIM_NONE) {
+		cache_access(rw, address, &scratch);
+		return;
+	}
+	decode_address(address, &tag, &index, &block_offset);
 	++logical_clock;
+	(this->*kernel.main)(rw, address, &scratch, tag, index, block_offset, &ev);
+	// the fill may have moved the block the fast path points at
+	last_way = NO_WAY;
+}
 
-	p_stats->accesses++;
+/**
+ * cache_access for one level of a hierarchy, which also needs to know
+ * whether the block has to come from below and what left this level.
+ *
+ * @dropped Set to the line the access pushed out of the victim cache, or
+ *          to an invalid entry if nothing left
+ * @return 1 if the access hit in the main or the victim cache
+ */
+int cache_sim_t::access_level(char rw, uint64_t address, cache_stats_t* p_stats,
+                              cache_entry_t *dropped) {
+	uint64_t misses = p_stats->read_misses_combined + p_stats->write_misses_combined;
 
-	if (rw == READ) {
-		p_stats->reads++;
-	} else {
-		p_stats->writes++;
-	}
+	memset(dropped, 0, sizeof(*dropped));
+	drop_out = dropped;
+	cache_access(rw, address, p_stats);
+	drop_out = NULL;
+	return misses == p_stats->read_misses_combined + p_stats->write_misses_combined;
+}
 
-	// First search in the cache. If found, return.
-	for (i=0; i<cache_metadata.blocks_per_set; i++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if (((cache_metadata.cache[index]+i)->tag == tag) &&
-				((cache_metadata.cache[index]+i)->valid1)) {
-				found = 1;
-			}
-		} else {
-			// sub blocking
-			if (block_offset < (cache_metadata.cacheline_size/2)) {
-				if (((cache_metadata.cache[index]+i)->tag == tag) &&
-					((cache_metadata.cache[index]+i)->valid1)) {
-					found = 1;
-				} else {
-					if (((cache_metadata.cache[index]+i)->tag == tag) &&
-						((cache_metadata.cache[index]+i)->valid2)) {
-						found_other_half = 1;
-					}
-				}
-			} else {
-				if (((cache_metadata.cache[index]+i)->tag == tag) &&
-					((cache_metadata.cache[index]+i)->valid2)) {
-					found = 1;
-				} else {
-					if (((cache_metadata.cache[index]+i)->tag == tag) &&
-						((cache_metadata.cache[index]+i)->valid1)) {
-						found_other_half = 1;
-					}
-				}
-			}
-		}
-		if (found || found_other_half) {
-			// data found. update Stats and return.
-			if (cache_metadata.replacement_policy == LRU) {
-				(cache_metadata.cache[index]+i)->clock_data.time_lru = logical_clock;
-			} else {
-				(cache_metadata.cache[index]+i)->clock_data.time_lru = logical_clock;
-				cache_metadata.nmru_reg[index] = tag;
-			}
-			if (rw == WRITE) {
-				(cache_metadata.cache[index]+i)->dirty = 1;
-			}
-			if (found_other_half) {
-				// Missed main cache and victim cache
-				if (rw == READ) {
-					p_stats->read_misses++;
-					p_stats->read_misses_combined++;
-				} else {
-					p_stats->write_misses++;
-					p_stats->write_misses_combined++;
-				}
-				//load the other half from memory and mark both valid :)
-				(cache_metadata.cache[index]+i)->valid1 = 1;
-				(cache_metadata.cache[index]+i)->valid2 = 1;
-			}
-			return;
+/**
+ * Remove the block holding address from the main or the victim cache
+ * without counting an access. The replacement policy picks the way that
+ * is freed, NMRU_FIFO keeps its ring contiguous.
+ *
+ * @out The removed line, with its dirty bit
+ * @return 1 if the block was present
+ */
+int cache_sim_t::invalidate(uint64_t address, cache_entry_t *out) {
+	uint64_t tag, index, block_offset, way;
+	uint64_t *word;
+	uint32_t slot;
+
+	last_way = NO_WAY;
+	decode_address(address, &tag, &index, &block_offset);
+	way = find_way(index, tag);
+	if (way != NO_WAY) {
+		load_entry(index, way, out);
+		way = replacement<0>::remove(this, index, way);
+		word = cache_metadata.valid1 + index * cache_metadata.mask_words;
+		bit_assign(word, way, 0);
+		word = cache_metadata.valid2 + index * cache_metadata.mask_words;
+		bit_assign(word, way, 0);
+		word = cache_metadata.dirty + index * cache_metadata.mask_words;
+		bit_assign(word, way, 0);
+		cache_metadata.valid_lines--;
+		if (cache_metadata.prefetch1) {
+			bit_assign(cache_metadata.prefetch1 + index * cache_metadata.mask_words, way, 0);
+			bit_assign(cache_metadata.prefetch2 + index * cache_metadata.mask_words, way, 0);
 		}
+		return 1;
 	}
 
-	// Missed main cache
-	if (rw == READ) {
-		p_stats->read_misses++;
-	} else {
-		p_stats->write_misses++;
+	slot = victim_find(address >> cache_metadata.block_offset_size);
+	if (slot != VICTIM_NONE) {
+		*out = cache_metadata.victim_cache[slot];
+		victim_unlink(slot);
+		cache_metadata.victim_cache[slot].valid1 = 0;
+		cache_metadata.victim_cache[slot].valid2 = 0;
+		victim_link<0>(slot);
+		return 1;
 	}
+	return 0;
+}
 
-	if (cache_metadata.replacement_policy == LRU) {
-		entry_to_evict = lru_entry_to_update(index);
-	} else {
-		// NMRU FIFO
-		entry_to_evict = nmru_entry_to_update(index);
+/**
+ * Set the dirty bit of the main cache line holding address, if any.
+ */
+void cache_sim_t::mark_dirty(uint64_t address) {
+	uint64_t tag, index, block_offset, way;
+
+	decode_address(address, &tag, &index, &block_offset);
+	way = find_way(index, tag);
+	if (way != NO_WAY) {
+		bit_assign(cache_metadata.dirty + index * cache_metadata.mask_words, way, 1);
 	}
+}
 
-	// data not found in cache. Look in victim cache
-	for (i=0; i<cache_metadata.victim_blocks; i++) {
-		if (cache_metadata.block_type == BLOCKING) {
-			if ((cache_metadata.victim_cache[i].tag == vict_tag) &&
-				(cache_metadata.victim_cache[i].valid1)) {
-				found = 1;
-			}
-		} else {
-			// sub blocking
-			if (block_offset < (cache_metadata.cacheline_size/2)) {
-				if ((cache_metadata.victim_cache[i].tag == vict_tag) &&
-					(cache_metadata.victim_cache[i].valid1)) {
-					found = 1;
-				} else {
-					if ((cache_metadata.victim_cache[i].tag == vict_tag) &&
-						(cache_metadata.victim_cache[i].valid2)) {
-						found_other_half = 1;
-					}
-				}
-			} else {
-				if ((cache_metadata.victim_cache[i].tag == vict_tag) &&
-					(cache_metadata.victim_cache[i].valid2)) {
-					found = 1;
-				} else {
-					if ((cache_metadata.victim_cache[i].tag == vict_tag) &&
-						(cache_metadata.victim_cache[i].valid1)) {
-						found_other_half = 1;
-					}
-				}
-			}
-		}
-		if (found || found_other_half) {
-			// found entry. swap entry
-			temp = *(cache_metadata.cache[index]+entry_to_evict);
-			if (cache_metadata.replacement_policy != LRU) {
-				entry_to_evict = nmru_push_entry(index, entry_to_evict);
-			}
-			*(cache_metadata.cache[index]+entry_to_evict) = cache_metadata.victim_cache[i];
-			cache_metadata.victim_cache[i] = temp;
-			//update appropriate tag size values
-			(cache_metadata.cache[index]+entry_to_evict)->tag = tag;
-			temp_tag = temp.address >> (cache_metadata.block_offset_size);
-			cache_metadata.victim_cache[i].tag = temp_tag;
-			cache_metadata.victim_cache[i].clock_data.time_lru = logical_clock;
-
-			if (cache_metadata.replacement_policy == LRU) {
-				(cache_metadata.cache[index]+entry_to_evict)->clock_data.time_lru = logical_clock;
-			} else {
-				(cache_metadata.cache[index]+entry_to_evict)->clock_data.time_lru = logical_clock;
-				cache_metadata.nmru_reg[index] = tag;
-			}
+/**
+ * Clear the dirty bit of the line holding address, in the main or the
+ * victim cache.
+ *
+ * @return 1 if the line was dirty
+ */
+int cache_sim_t::mark_clean(uint64_t address) {
+	uint64_t tag, index, block_offset, way;
+	uint64_t *word;
+	uint32_t slot;
+	int dirty = 0;
 
-			if (found_other_half) {
-				// Missed main cache and victim cache
-				if (rw == READ) {
-					p_stats->read_misses_combined++;
-				} else {
-					p_stats->write_misses_combined++;
-				}
-				//load the other half from memory and mark both valid :)
-				(cache_metadata.cache[index]+entry_to_evict)->valid1 = 1;
-				(cache_metadata.cache[index]+entry_to_evict)->valid2 = 1;
-			}
-			if (rw == WRITE) {
-				(cache_metadata.cache[index]+entry_to_evict)->dirty = 1;
-			}
-			return;
-		}
+	decode_address(address, &tag, &index, &block_offset);
+	way = find_way(index, tag);
+	if (way != NO_WAY) {
+		word = cache_metadata.dirty + index * cache_metadata.mask_words;
+		dirty = bit_test(word, way);
+		bit_assign(word, way, 0);
+		return dirty;
 	}
-
-	// Missed main cache
-	if (rw == READ) {
-		p_stats->read_misses_combined++;
-	} else {
-		p_stats->write_misses_combined++;
+	slot = victim_find(address >> cache_metadata.block_offset_size);
+	if (slot != VICTIM_NONE) {
+		dirty = cache_metadata.victim_cache[slot].dirty;
+		cache_metadata.victim_cache[slot].dirty = 0;
 	}
+	return dirty;
+}
 
-	if (cache_metadata.block_type == BLOCKING) {
-		if (!((cache_metadata.cache[index]+entry_to_evict)->valid1)) {
-			invalid_entry = 1;
+/**
+ * Append the address of every dirty line, in the main and the victim
+ * cache, to out: what complete_cache is about to write back.
+ */
+void cache_sim_t::dirty_blocks(std::vector<uint64_t> *out) const {
+	const uint64_t ways = cache_metadata.blocks_per_set;
+	const victim_index_t *vi = &cache_metadata.victim_index;
+	const uint64_t *word;
+	uint64_t index, way, tag, block_offset;
+	std::unordered_set<uint64_t>::const_iterator it;
+	uint32_t slot;
+
+	for (index=0; index<cache_metadata.total_sets; index++) {
+		word = cache_metadata.dirty + index * cache_metadata.mask_words;
+		for (way=0; way<ways; way++) {
+			if (bit_test(word, way) && way_valid<0>(index, way)) {
+				out->push_back(((cache_metadata.tags[index * ways + way] << cache_metadata.index_size) |
+				                index) << cache_metadata.block_offset_size);
+			}
 		}
-	} else {
-		if ((!((cache_metadata.cache[index]+entry_to_evict)->valid1)) &&
-		    (!((cache_metadata.cache[index]+entry_to_evict)->valid2))) {
-			invalid_entry = 1;
+	}
+	// a pending block still in its set is dirty whatever its bit says
+	for (it=pending_dirty.begin(); it!=pending_dirty.end(); ++it) {
+		decode_address(*it << cache_metadata.block_offset_size, &tag, &index, &block_offset);
+		way = find_way(index, tag);
+		if ((way != NO_WAY) && !bit_test(cache_metadata.dirty + index * cache_metadata.mask_words, way)) {
+			out->push_back(*it << cache_metadata.block_offset_size);
 		}
 	}
-
-	if (!invalid_entry) {
-		// not in victim cache too. Move entry to victim cache first.
-		vict_entry = victim_to_update();
-		temp = *(cache_metadata.cache[index]+entry_to_evict);
-
-		if (cache_metadata.replacement_policy != LRU) {
-			entry_to_evict = nmru_push_entry(index, entry_to_evict);
+	for (slot=vi->lru; slot!=VICTIM_NONE; slot=vi->next[slot]) {
+		if (cache_metadata.victim_cache[slot].dirty) {
+			out->push_back(cache_metadata.victim_cache[slot].tag << cache_metadata.block_offset_size);
 		}
-
-		// evict victim, need to write to memory if dirty
-		cache_metadata.victim_cache[vict_entry] = temp;
-		temp_tag = temp.address >> (cache_metadata.block_offset_size);
-		cache_metadata.victim_cache[vict_entry].tag = temp_tag;
-		cache_metadata.victim_cache[vict_entry].clock_data.time_lru = logical_clock;
 	}
+}
+
+/**
+ * Sets can be simulated independently when the main cache never depends on
+ * what the victim cache hands back. With SUBBLOCKING a victim hit decides
+ * which halves of the refilled entry are valid, and with NO_WRITE_ALLOCATE
+ * whether a store fills a line at all, so neither qualifies. Prefetches
+ * fill sets out of turn, so neither does a prefetcher, nor a replacement
+ * policy with state shared by all sets. A miss classifier needs the
+ * accesses in trace order. A dirty bit a victim hit brings back is carried
+ * in pending_dirty instead.
+ */
+int cache_sim_t::shardable() const {
+	return (cache_metadata.block_type == BLOCKING) && (allocate_policy == WRITE_ALLOCATE) &&
+	       (prefetcher == PREFETCH_NONE) && replacement<0>::per_set(&cache_metadata) &&
+	       !classifier;
+}
 
-	// update the cache entry now
-	(cache_metadata.cache[index]+entry_to_evict)->address = address;
-	(cache_metadata.cache[index]+entry_to_evict)->tag = tag;
+/**
+ * Cycles of a hit in the configuration set up last.
+ */
+uint64_t cache_sim_t::hit_time() const {
+	return ceil(cache_metadata.blocks_per_set * (0.2));
+}
 
+/**
+ * Cycles a miss adds to the hit time, fetching a line or a half.
+ */
+uint64_t cache_sim_t::miss_penalty() const {
 	if (cache_metadata.block_type == BLOCKING) {
-		(cache_metadata.cache[index]+entry_to_evict)->valid1 = 1;
-	} else {
-		if (block_offset < (cache_metadata.cacheline_size/2)) {
-			(cache_metadata.cache[index]+entry_to_evict)->valid1 = 1;
-			(cache_metadata.cache[index]+entry_to_evict)->valid2 = 0;
-		} else {
-			(cache_metadata.cache[index]+entry_to_evict)->valid2 = 1;
-			(cache_metadata.cache[index]+entry_to_evict)->valid1 = 0;
-		}
+		return ceil((cache_metadata.blocks_per_set * (0.2)) + 50 +
+		            ((0.25) * cache_metadata.cacheline_size));
 	}
+	return ceil((cache_metadata.blocks_per_set * (0.2)) + 50 +
+	            ((0.25) * (cache_metadata.cacheline_size/2)));
+}
 
-	if (rw == WRITE) {
-		(cache_metadata.cache[index]+entry_to_evict)->dirty = 1;
-	} else {
-		(cache_metadata.cache[index]+entry_to_evict)->dirty = 0;
-	}
+uint64_t cache_sim_t::sets() const {
+	return cache_metadata.total_sets;
+}
 
-	if (cache_metadata.replacement_policy == LRU) {
-		(cache_metadata.cache[index]+entry_to_evict)->clock_data.time_lru = logical_clock;
-	} else {
-		(cache_metadata.cache[index]+entry_to_evict)->clock_data.time_lru = logical_clock;
-		cache_metadata.nmru_reg[index] = tag;
-	}
+uint64_t cache_sim_t::line_size() const {
+	return cache_metadata.cacheline_size;
 }
 
 /**
- * Subroutine that simulates the cache one trace event at a time.
- * XXX: You're responsible for completing this routine
+ * Share of the main cache and of the victim cache holding valid lines.
+ */
+void cache_sim_t::occupancy(double *main_cache, double *victim_cache) const {
+	*main_cache = (double) cache_metadata.valid_lines /
+	              (cache_metadata.total_sets * cache_metadata.blocks_per_set);
+	*victim_cache = (double) (cache_metadata.victim_blocks - cache_metadata.victim_index.free_count) /
+	                cache_metadata.victim_blocks;
+}
+
+/**
+ * Write the simulated state and the counters so far to path, after offset
+ * trace accesses. Arena pages that are all zero are skipped, which keeps
+ * the file as sparse as the arena.
  *
- * @rw The type of event. Either READ or WRITE
- * @address  The target memory address
- * @p_stats Pointer to the statistics structure
+ * @return 0 on success, -1 on error
  */
-void cache_access(char rw, uint64_t address, cache_stats_t* p_stats) {
-	uint64_t block_offset;
-	uint64_t index, tag;
+int cache_sim_t::save_checkpoint(const char *path, const cache_stats_t *p_stats,
+                                 uint64_t offset) const {
+	static const char zero[ARENA_PAGE] = { 0 };
+	const victim_index_t *vi = &cache_metadata.victim_index;
+	uint64_t pages = (arena_used + ARENA_PAGE - 1) / ARENA_PAGE;
+	char header_page[ARENA_PAGE];
+	checkpoint_header_t *h = (checkpoint_header_t *) header_page;
+	uint64_t j;
+	int fd;
+
+	if (!arena) {
+		fprintf(stderr, "%s: no cache to checkpoint\n", path);
+		return -1;
+	}
+	memset(header_page, 0, sizeof(header_page));
+	memcpy(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic));
+	h->version = CHECKPOINT_VERSION;
+	h->header_size = sizeof(checkpoint_header_t);
+	h->c = __builtin_ctzll(cache_metadata.total_data_storage);
+	h->b = cache_metadata.block_offset_size;
+	h->s = __builtin_ctzll(cache_metadata.blocks_per_set);
+	h->v = __builtin_ctzll(cache_metadata.victim_blocks);
+	h->st = cache_metadata.block_type;
+	h->r = cache_metadata.replacement_policy;
+	h->write_policy = write_policy;
+	h->allocate_policy = allocate_policy;
+	h->prefetcher = prefetcher;
+	h->offset = offset;
+	h->logical_clock = logical_clock;
+	h->last_block = last_block;
+	h->last_index = last_index;
+	h->last_way = last_way;
+	h->victim_free_count = vi->free_count;
+	h->victim_lru = vi->lru;
+	h->victim_mru = vi->mru;
+	h->arena_used = arena_used;
+	h->stats = *p_stats;
 
-	tag = address >> (cache_metadata.block_offset_size + cache_metadata.index_size);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (pwrite(fd, header_page, ARENA_PAGE, 0) != ARENA_PAGE) {
+		goto fail;
+	}
+	for (j=0; j<pages; j++) {
+		if (!memcmp(arena + j * ARENA_PAGE, zero, ARENA_PAGE)) {
+			continue;
+		}
+		if (pwrite(fd, arena + j * ARENA_PAGE, ARENA_PAGE, (j + 1) * ARENA_PAGE) != ARENA_PAGE) {
+			goto fail;
+		}
+	}
+	if (ftruncate(fd, (pages + 1) * ARENA_PAGE) < 0) {
+		goto fail;
+	}
+	return close(fd);
 
-	index = ((1 << (cache_metadata.index_size + cache_metadata.block_offset_size)) - 1);
-	//index = index << tag_size;
-	index = address & index;
-	index = index >> (cache_metadata.block_offset_size);
+fail:
+	perror(path);
+	close(fd);
+	return -1;
+}
 
-	block_offset = ((1 << (cache_metadata.block_offset_size)) - 1);
-	block_offset = address & block_offset;
+/**
+ * Continue from a checkpoint saved for the configuration this instance is
+ * set up for. The saved arena is mapped copy on write over the current
+ * one, so only the pages the rest of the trace touches are ever read.
+ * The prefetch queue and streams are not saved and start out empty.
+ *
+ * @offset set to the trace accesses the checkpoint had simulated
+ * @return 0 on success, -1 on error
+ */
+int cache_sim_t::restore_checkpoint(const char *path, cache_stats_t *p_stats, uint64_t *offset) {
+	victim_index_t *vi = &cache_metadata.victim_index;
+	uint64_t bytes = (arena_used + ARENA_PAGE - 1) & ~(uint64_t) (ARENA_PAGE - 1);
+	checkpoint_header_t h;
+	struct stat st;
+	uint64_t j;
+	int fd;
 
-	//printf("%lu, %lu, %lu\n", tag, index, block_offset);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if ((pread(fd, &h, sizeof(h), 0) != sizeof(h)) ||
+	    memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) ||
+	    (h.version != CHECKPOINT_VERSION) || (h.header_size != sizeof(h))) {
+		fprintf(stderr, "%s: not a version %d checkpoint\n", path, CHECKPOINT_VERSION);
+		close(fd);
+		return -1;
+	}
+	if ((h.c != (uint64_t) __builtin_ctzll(cache_metadata.total_data_storage)) ||
+	    (h.b != cache_metadata.block_offset_size) ||
+	    (h.s != (uint64_t) __builtin_ctzll(cache_metadata.blocks_per_set)) ||
+	    (h.v != (uint64_t) __builtin_ctzll(cache_metadata.victim_blocks)) ||
+	    (h.st != cache_metadata.block_type) || (h.r != cache_metadata.replacement_policy) ||
+	    (h.write_policy != write_policy) || (h.allocate_policy != allocate_policy) ||
+	    (h.prefetcher != prefetcher) ||
+	    (h.arena_used != arena_used)) {
+		fprintf(stderr, "%s: checkpoint is for C=%" PRIu64 " B=%" PRIu64 " S=%" PRIu64
+		        " V=%" PRIu64 " %c %c, writes %c %c, prefetch %c\n", path, h.c, h.b, h.s, h.v,
+		        h.st, h.r, h.write_policy, h.allocate_policy, h.prefetcher);
+		close(fd);
+		return -1;
+	}
+	if ((fstat(fd, &st) < 0) || ((uint64_t) st.st_size < ARENA_PAGE + bytes)) {
+		fprintf(stderr, "%s: checkpoint is truncated\n", path);
+		close(fd);
+		return -1;
+	}
+	if (mmap(arena, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+	         ARENA_PAGE) == MAP_FAILED) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	// the next setup_cache maps fresh zero pages rather than reuse these
+	arena_from_file = 1;
 
-	// retrieve block Offset, Index and Tag from the address
-	read_write(rw, address, p_stats, tag, index, block_offset);
+	logical_clock = h.logical_clock;
+	last_block = h.last_block;
+	last_index = h.last_index;
+	last_way = h.last_way;
+	vi->free_count = h.victim_free_count;
+	vi->lru = h.victim_lru;
+	vi->mru = h.victim_mru;
+	cache_metadata.valid_lines = 0;
+	for (j=0; j<cache_metadata.total_sets; j++) {
+		cache_metadata.valid_lines += valid_ways<0, 0>(j);
+	}
+	*p_stats = h.stats;
+	*offset = h.offset;
+	return 0;
 }
 
 /**
@@ -458,20 +2282,24 @@ void cache_access(char rw, uint64_t address, cache_stats_t* p_stats) {
  *
  * @p_stats Pointer to the statistics structure
  */
-void complete_cache(cache_stats_t *p_stats) {
+void cache_sim_t::complete_cache(cache_stats_t *p_stats) {
+	flush_dirty(p_stats);
+
 	p_stats->misses = p_stats->read_misses_combined + p_stats->write_misses_combined;
 
 	p_stats->miss_rate = (double) p_stats->misses/p_stats->accesses;
-	p_stats->hit_time = ceil(cache_metadata.blocks_per_set * (0.2));
-
-	if (cache_metadata.block_type == BLOCKING) {
-		p_stats->miss_penalty = ceil((cache_metadata.blocks_per_set * (0.2)) + 50 +
-							((0.25) * cache_metadata.cacheline_size));
-	} else {
-		p_stats->miss_penalty = ceil((cache_metadata.blocks_per_set * (0.2)) + 50 +
-							((0.25) * (cache_metadata.cacheline_size/2)));
-	}
+	p_stats->hit_time = hit_time();
+	p_stats->miss_penalty = miss_penalty();
 	p_stats->avg_access_time = (double) (p_stats->hit_time + (p_stats->miss_rate * p_stats->miss_penalty));
+	// the miss penalty already pays for fills; writes hold the bus as well
+	p_stats->traffic_access_time = p_stats->avg_access_time +
+	                               (double) p_stats->bytes_written * CYCLES_PER_BYTE / p_stats->accesses;
+
+	p_stats->prefetch_accuracy = p_stats->prefetches ?
+	                             (double) p_stats->prefetch_useful / p_stats->prefetches : 0;
+	p_stats->prefetch_coverage = (p_stats->prefetch_useful + p_stats->misses) ?
+	                             (double) p_stats->prefetch_useful /
+	                             (p_stats->prefetch_useful + p_stats->misses) : 0;
 
 	p_stats->storage_overhead = cache_metadata.total_overhead_bits;
 	p_stats->storage_overhead_ratio = (double) ((double) cache_metadata.total_overhead_bits / 8);
@@ -479,3 +2307,19 @@ void complete_cache(cache_stats_t *p_stats) {
 		                                        cache_metadata.total_storage);
 
 }
+
+void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r) {
+	default_cache.setup_cache(c, b, s, v, st, r);
+}
+
+void cache_access(char rw, uint64_t address, cache_stats_t* p_stats) {
+	default_cache.cache_access(rw, address, p_stats);
+}
+
+void cache_access_batch(const access_t *accesses, size_t n, cache_stats_t* p_stats) {
+	default_cache.cache_access_batch(accesses, n, p_stats);
+}
+
+void complete_cache(cache_stats_t *p_stats) {
+	default_cache.complete_cache(p_stats);
+}
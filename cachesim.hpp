@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unordered_set>
+#include <vector>
 
 #define ADDRESS_SIZE 64
 #define MAX_4BIT 16 
@@ -25,22 +27,60 @@ struct cache_stats_t {
     double   avg_access_time;
     uint64_t storage_overhead;
     double   storage_overhead_ratio;
+    uint64_t fast_hits;   // accesses the repeated-block fast path resolved
+    uint64_t writebacks;  // dirty lines sent to the next level or memory
+    uint64_t bytes_read;     // fetched from the next level or memory
+    uint64_t bytes_written;  // written back or written through to it
+    double   traffic_access_time;  // AAT plus the bus time of bytes_written
+    uint64_t prefetches;          // prefetched lines or halves filled
+    uint64_t prefetch_useful;     // of which a demand access used
+    uint64_t prefetch_useless;    // left the cache or the run unused
+    uint64_t prefetch_late;       // demand misses on a prefetch still in flight
+    uint64_t prefetch_dropped;    // queue full, or already cached when issued
+    uint64_t prefetch_pollution;  // demand misses on lines a prefetch pushed out
+    double   prefetch_accuracy;   // useful / prefetches
+    double   prefetch_coverage;   // useful / (useful + misses)
+    uint64_t compulsory_misses;   // with a miss_classifier_t attached
+    uint64_t capacity_misses;
+    uint64_t conflict_misses;
 };
 
-typedef struct clock {
-	uint64_t time_lru;
-	uint8_t time_other:4;
-} logclock_t;
+/** One decoded trace record */
+struct access_t {
+    char     rw;
+    uint64_t address;
+};
 
+// a victim cache entry; main cache lines live in the cache_t arrays
 typedef struct cache_entry {
-	uint64_t address;
-	uint64_t tag;
+	uint64_t tag;      // block address, address >> b
 	uint8_t dirty:1;
 	uint8_t valid1:1;
 	uint8_t valid2:1;
-	logclock_t clock_data;
+	uint8_t prefetch1:1;  // the half was prefetched and not used yet
+	uint8_t prefetch2:1;
 } cache_entry_t;
 
+#define VICTIM_NONE UINT32_MAX
+#define LIST_NONE 0
+
+/**
+ * O(1) bookkeeping for the victim cache: a chained hash index from block
+ * address to slot over the valid entries, and an intrusive doubly linked
+ * list ordering them from LRU to MRU. Invalid slots sit on a free stack.
+ */
+struct victim_index_t {
+	uint32_t *buckets;     // first slot of each hash chain
+	uint32_t *chain;       // next slot in the same chain
+	uint32_t *prev;        // LRU list, towards the LRU end
+	uint32_t *next;        // LRU list, towards the MRU end
+	uint32_t *free_slots;
+	uint32_t free_count;
+	uint32_t lru;
+	uint32_t mru;
+	uint32_t hash_bits;
+};
+
 struct cache_t {
 	uint64_t total_data_storage; //c
 	char     block_type;         //st
@@ -57,12 +97,278 @@ struct cache_t {
 	uint64_t total_overhead_bits;
 	uint64_t total_sets;
 	uint64_t tag_length;
-	cache_entry_t **cache;
+	// tag store, way w of set i at [i * blocks_per_set + w]
+	uint64_t *tags;
+	// LRU: per set recency list of ways, head is the LRU end, links are
+	// way + 1 and LIST_NONE ends a list
+	uint32_t *lru_prev;
+	uint32_t *lru_next;
+	uint32_t *lru_head;
+	uint32_t *lru_tail;
+	// NMRU_FIFO: per set ring of ways in fill order, fifo_head the oldest
+	uint32_t *fifo_head;
+	// TREE_PLRU: mask_words words per set, bit n for node n of the tree
+	// over the ways, root 1; a set bit sends the victim search right
+	uint64_t *plru;
+	// RRIP policies: 2 bit re-reference prediction values, 32 per word
+	uint64_t rrpv_words;
+	uint64_t *rrpv;
+	// SHIP: per line signature, with SHIP_REUSED once the line hit, and
+	// the saturating counters the signatures index
+	uint16_t *ship_line;
+	uint8_t *shct;
+	// DRRIP selector and BRRIP fill count, kept in the arena so a
+	// checkpoint has them
+	int64_t *duel;
+	// per set bitmasks, mask_words words per set, bit w for way w
+	uint64_t mask_words;
+	uint64_t *valid1;
+	uint64_t *valid2;
+	uint64_t *dirty;
+	// main cache ways with either half valid, kept on every fill and
+	// invalidate; sharded fills add to it atomically
+	uint64_t valid_lines;
+	// prefetched and not used yet, per half like valid1 and valid2; only
+	// carved when a prefetcher is on
+	uint64_t *prefetch1;
+	uint64_t *prefetch2;
+	// block address + 1 of lines prefetch fills pushed out, direct mapped
+	uint64_t *pollution;
 	cache_entry_t *victim_cache;
+	victim_index_t victim_index;
 	uint64_t *nmru_reg;
 };
 
+#define NO_WAY UINT64_MAX
+
+// RRIP: the value a victim must have, and the one a line is filled with
+#define RRPV_MAX 3
+#define RRPV_LONG 2
+// BRRIP fills with RRPV_LONG once per this many fills, else RRPV_MAX
+#define BRRIP_THROTTLE 32
+// DRRIP: one SRRIP and one BRRIP leader set in this many, and the bound
+// of the 10 bit selector
+#define DUEL_PERIOD 32
+#define PSEL_MAX 511
+// SHIP: signatures hash the 2^SHIP_REGION_BITS byte region of an access
+#define SHIP_REGION_BITS 12
+#define SHIP_SIG_BITS 14
+#define SHIP_REUSED 0x8000
+#define SHCT_MAX 7
+
+template <char R> struct replacement;
+
+// every cache_t array is carved from one arena at this alignment
+#define ARENA_ALIGN 64
+#define ARENA_PAGE 4096
+#define ARENA_HUGE_PAGE (2 << 20)
+
+// accesses cache_access_batch decodes and prefetches ahead of simulating
+#define BATCH_AHEAD 16
+
+/*
+ * Checkpoint file format
+ *
+ * A checkpoint_header_t padded to ARENA_PAGE bytes, then the arena as it
+ * was laid out for the configuration, so a restore maps it back in place.
+ * Pages of the arena that were never touched are left as holes.
+ */
+#define CHECKPOINT_MAGIC "\x89" "CSIMCKP"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header_t {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;    // sizeof(checkpoint_header_t), catches layout changes
+	uint64_t c, b, s, v;
+	char     st, r;
+	char     write_policy;
+	char     allocate_policy;
+	char     prefetcher;
+	char     reserved[3];
+	uint64_t offset;         // trace accesses simulated before the checkpoint
+	uint64_t logical_clock;
+	uint64_t last_block;
+	uint64_t last_index;
+	uint64_t last_way;
+	uint32_t victim_free_count;
+	uint32_t victim_lru;
+	uint32_t victim_mru;
+	uint32_t reserved2;
+	uint64_t arena_used;
+	cache_stats_t stats;     // counters at the checkpoint, not completed
+};
+
+// prefetches waiting for memory, and the accesses they take to arrive
+#define PREFETCH_QUEUE 8
+#define PREFETCH_DELAY 16
+// stream detector: streams tracked, fill units a miss may be from a
+// stream's last one to extend it, and lines prefetched past the
+// PREFETCH_DELAY lead once it is confirmed
+#define PREFETCH_STREAMS 16
+#define PREFETCH_WINDOW 16
+#define PREFETCH_DEGREE 4
+// lines remembered as pushed out by a prefetch
+#define POLLUTION_FILTER 1024
+
+/** A prefetch waiting in the queue */
+struct prefetch_slot_t {
+	uint64_t address;
+	uint64_t ready;     // logical clock it arrives at
+	int      live;      // 0 once a demand miss overtook it
+};
+
+/** One stream of the stride detector */
+struct prefetch_stream_t {
+	uint64_t last;      // last line, or half line when SUBBLOCKING, missed on
+	int64_t  stride;    // in the same units
+	uint64_t confirmed; // times in a row the stride repeated
+	uint64_t used;      // logical clock, to replace the least recent stream
+	uint64_t ahead;     // strides past last already queued, the frontier
+};
+
+/** A main cache miss on its way to the victim cache */
+struct victim_event_t {
+	cache_entry_t evicted;  // the entry the miss replaced
+	uint64_t index;         // set and way of the refilled entry,
+	uint64_t way;           // NO_WAY to leave it alone
+	uint64_t address;
+	char rw;                // 0 when the access hit the main cache
+};
+
+class miss_classifier_t;
+
+/**
+ * One simulated cache. Every instance owns its cache_t and logical clock, so
+ * any number of configurations can be simulated side by side.
+ */
+class cache_sim_t {
+public:
+	cache_sim_t();
+	~cache_sim_t();
+
+	void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r);
+	void cache_access(char rw, uint64_t address, cache_stats_t* p_stats);
+	void cache_access_batch(const access_t *accesses, size_t n, cache_stats_t* p_stats);
+	void complete_cache(cache_stats_t *p_stats);
+	void warm_access(char rw, uint64_t address);
+
+	// the two halves of an access, for simulating sets on separate threads.
+	// They bypass the repeated-block fast path, so a setup is driven either
+	// through these or through cache_access, not both.
+	void decode_address(uint64_t address, uint64_t *tag, uint64_t *index,
+	                    uint64_t *block_offset) const;
+	int main_lookup(char rw, uint64_t address, cache_stats_t* p_stats, uint64_t tag,
+	                uint64_t index, uint64_t block_offset, victim_event_t *ev);
+	void victim_lookup(const victim_event_t *ev, cache_stats_t* p_stats);
+	int shardable() const;
+	uint64_t sets() const;
+	uint64_t line_size() const;
+	void occupancy(double *main_cache, double *victim_cache) const;
+
+	// one level of a cache hierarchy
+	int access_level(char rw, uint64_t address, cache_stats_t* p_stats, cache_entry_t *dropped);
+	int invalidate(uint64_t address, cache_entry_t *out);
+	void mark_dirty(uint64_t address);
+	int mark_clean(uint64_t address);
+	void dirty_blocks(std::vector<uint64_t> *out) const;
+
+	// warm state, for the configuration this instance is set up for
+	int save_checkpoint(const char *path, const cache_stats_t *p_stats, uint64_t offset) const;
+	int restore_checkpoint(const char *path, cache_stats_t *p_stats, uint64_t *offset);
+
+	void select_kernels(int generic);
+	void use_huge_pages(int on);
+	void set_write_policy(char write, char allocate);
+	void set_prefetcher(char prefetcher);
+	void set_classifier(miss_classifier_t *classifier);
+	uint64_t hit_time() const;
+	uint64_t miss_penalty() const;
+	double host_bytes_per_line() const;
+	uint64_t host_bytes_resident() const;
+
+private:
+	template <char R> friend struct replacement;
+
+	cache_sim_t(const cache_sim_t &);
+	cache_sim_t &operator=(const cache_sim_t &);
+
+	void free_cache();
+	uint64_t line_bytes(const cache_entry_t *entry) const;
+	void write_back(const cache_entry_t *entry, cache_stats_t* p_stats);
+	void flush_dirty(cache_stats_t *p_stats);
+	int cached(uint64_t address) const;
+	int prefetch_enqueue(uint64_t address, cache_stats_t* p_stats);
+	void prefetch_fill(uint64_t address, cache_stats_t* p_stats);
+	void prefetch_arrive(cache_stats_t* p_stats);
+	void prefetch_train(uint64_t address, int missed, int useful, cache_stats_t* p_stats);
+	uint64_t layout_arena(char *base);
+	template <char ST, uint64_t WAYS> uint64_t first_invalid_way(uint64_t index) const;
+	template <char ST, uint64_t WAYS> uint64_t valid_ways(uint64_t index) const;
+	uint64_t find_way(uint64_t index, uint64_t tag) const;
+	template <char ST> int way_valid(uint64_t index, uint64_t way) const;
+	void move_way(uint64_t index, uint64_t from, uint64_t to);
+	void load_entry(uint64_t index, uint64_t way, cache_entry_t *entry) const;
+	void store_entry(uint64_t index, uint64_t way, const cache_entry_t *entry);
+	uint32_t victim_find(uint64_t vict_tag) const;
+	void victim_unlink(uint32_t slot);
+	template <char ST> void victim_link(uint32_t slot);
+	uint32_t victim_to_update();
+	template <char ST, uint64_t WAYS> uint64_t lru_entry_to_update(uint64_t index);
+	template <uint64_t WAYS> void lru_touch(uint64_t index, uint64_t way);
+	template <char ST, uint64_t WAYS> uint64_t nmru_entry_to_update(uint64_t index);
+	template <char ST, uint64_t WAYS> uint64_t nmru_push_entry(uint64_t index, uint64_t entry);
+
+	// access path specialized on block type, policy and ways, 0 = run time
+	template <char ST, char R, uint64_t WAYS>
+	void access_kernel(char rw, uint64_t address, cache_stats_t* p_stats);
+	template <char ST, char R, uint64_t WAYS>
+	int main_kernel(char rw, uint64_t address, cache_stats_t* p_stats, uint64_t tag,
+	                uint64_t index, uint64_t block_offset, victim_event_t *ev);
+	template <char ST>
+	void victim_kernel(const victim_event_t *ev, cache_stats_t* p_stats);
+	template <char ST, char R, uint64_t WAYS>
+	int fast_hit(char rw, uint64_t address, cache_stats_t* p_stats);
+	template <char ST, char R, uint64_t WAYS>
+	void batch_kernel(const access_t *accesses, size_t n, cache_stats_t* p_stats);
+
+	struct kernel_set_t {
+		void (cache_sim_t::*access)(char, uint64_t, cache_stats_t*);
+		int (cache_sim_t::*main)(char, uint64_t, cache_stats_t*, uint64_t, uint64_t, uint64_t,
+		                         victim_event_t*);
+		void (cache_sim_t::*victim)(const victim_event_t*, cache_stats_t*);
+		void (cache_sim_t::*batch)(const access_t*, size_t, cache_stats_t*);
+	};
+
+	cache_t cache_metadata;
+	uint64_t logical_clock;
+	// block of the previous access and where it sits, last_way NO_WAY if none
+	uint64_t last_block;
+	uint64_t last_index;
+	uint64_t last_way;
+	cache_entry_t *drop_out;  // where access_level wants the dropped line
+	miss_classifier_t *classifier;  // sees every demand access when set
+	kernel_set_t kernel;
+	char *arena;
+	uint64_t arena_size;   // mapped bytes
+	uint64_t arena_used;   // bytes the current configuration needs
+	int huge_pages;
+	int arena_from_file;   // restored pages are a private file mapping
+	char write_policy;     // WRITE_BACK or WRITE_THROUGH
+	char allocate_policy;  // WRITE_ALLOCATE or NO_WRITE_ALLOCATE
+	// sharded runs: blocks a victim hit made dirty while their set was
+	// out of reach, applied when they are evicted or flushed
+	std::unordered_set<uint64_t> pending_dirty;
+	char prefetcher;       // PREFETCH_NONE, _NEXT_LINE, _STRIDE or _HALF
+	prefetch_slot_t prefetch_queue[PREFETCH_QUEUE];
+	uint64_t prefetch_head;
+	uint64_t prefetch_count;
+	prefetch_stream_t streams[PREFETCH_STREAMS];
+};
+
+// the single-configuration interface, backed by one default instance
 void cache_access(char rw, uint64_t address, cache_stats_t* p_stats);
+void cache_access_batch(const access_t *accesses, size_t n, cache_stats_t* p_stats);
 void setup_cache(uint64_t c, uint64_t b, uint64_t s, uint64_t v, char st, char r);
 void complete_cache(cache_stats_t *p_stats);
 
@@ -77,8 +383,35 @@ static const char     DEFAULT_ST = BLOCKING;
 
 static const char     LRU = 'L';
 static const char     NMRU_FIFO = 'N';
+static const char     TREE_PLRU = 'P';
+static const char     SRRIP = 'R';
+static const char     BRRIP = 'B';
+static const char     DRRIP = 'D';
+static const char     SHIP = 'H';
 static const char     DEFAULT_R = LRU;
 
+// printable name of replacement policy r, NULL if there is none
+const char *replacement_name(char r);
+
+static const char     WRITE_BACK = 'b';
+static const char     WRITE_THROUGH = 't';
+static const char     DEFAULT_W = WRITE_BACK;
+
+static const char     WRITE_ALLOCATE = 'a';
+static const char     NO_WRITE_ALLOCATE = 'n';
+static const char     DEFAULT_A = WRITE_ALLOCATE;
+
+static const char     PREFETCH_NONE = 'n';
+static const char     PREFETCH_NEXT_LINE = 'l';
+static const char     PREFETCH_STRIDE = 's';
+static const char     PREFETCH_HALF = 'h';
+static const char     DEFAULT_P = PREFETCH_NONE;
+
+// bytes one store sends to memory when it writes through or around
+static const uint64_t STORE_BYTES = 8;
+// bus cycles per byte, the rate the miss penalty charges for a line fill
+static const double   CYCLES_PER_BYTE = 0.25;
+
 /** Argument to cache_access rw. Indicates a load */
 static const char     READ = 'r';
 /** Argument to cache_access rw. Indicates a store */
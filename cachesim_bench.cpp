@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "cachesim.hpp"
+#include "sweep.hpp"
+#include "trace.hpp"
+
+// synthetic access patterns
+static const char     GEN_SEQUENTIAL = 's';
+static const char     GEN_STRIDED = 't';
+static const char     GEN_RANDOM = 'r';
+static const char     GEN_ZIPF = 'z';
+static const char     GEN_CHASE = 'c';
+static const char     GEN_MIX = 'm';
+
+// bytes between two accesses of the strided pattern, not a power of two
+// so it walks every set
+static const uint64_t STRIDE_BYTES = 264;
+
+/** One row of the suite: a pattern, its share of writes, a geometry and its speed */
+struct bench_row_t {
+    char           gen;
+    unsigned       write_pct;
+    sweep_config_t config;
+    double         macc_s;
+};
+
+// the generators at their usual write mix, and the mix at three, on
+// geometries from direct-mapped to 64-way and every replacement policy
+static const char suite_gens[] = { GEN_SEQUENTIAL, GEN_STRIDED, GEN_RANDOM, GEN_ZIPF, GEN_CHASE,
+                                   GEN_MIX, GEN_MIX, GEN_MIX };
+static const unsigned suite_write_pcts[] = { 25, 25, 25, 25, 0, 0, 25, 50 };
+static const sweep_config_t suite_configs[] = {
+    { 15, 5, 3, 2, BLOCKING, LRU },
+    { 15, 5, 0, 0, BLOCKING, LRU },
+    { 15, 6, 2, 2, SUBBLOCKING, NMRU_FIFO },
+    { 18, 6, 4, 0, BLOCKING, SRRIP },
+    { 12, 5, 6, 0, BLOCKING, TREE_PLRU },
+    { 15, 5, 3, 2, BLOCKING, SHIP },
+};
+
+void print_help_and_exit(void) {
+    printf("cachesim-bench [OPTIONS]\n");
+    printf("  -i FILE\tTrace to replay, text or binary (default: synthetic)\n");
+    printf("  -n N\t\tSynthetic accesses (default 4000000, 1000000 with -x)\n");
+    printf("  -g G\t\tSynthetic pattern: s (sequential), t (strided), r (uniform random),\n");
+    printf("\t\tz (Zipfian hot set), c (pointer chase) or m (stream and random, default)\n");
+    printf("  -w PCT\tShare of synthetic accesses that are writes (default 25)\n");
+    printf("  -c C\t\tTotal size in bytes is 2^C (default 15)\n");
+    printf("  -b B\t\tSize of each block in bytes is 2^B (default 5)\n");
+    printf("  -v V\t\tNumber of blocks in victim cache is 2^V (default 2)\n");
+    printf("  -x\t\tThroughput suite: every pattern on a matrix of geometries, as CSV\n");
+    printf("  -k N\t\tSuite: best of N runs per row (default 5)\n");
+    printf("  -B FILE\tSuite: fail rows slower than the same rows of a saved suite CSV\n");
+    printf("  -T PCT\tSuite: mean slowdown against -B tolerated (default 15)\n");
+    printf("  -h\t\tThis helpful output\n");
+    exit(0);
+}
+
+static uint64_t xorshift(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/**
+ * Reproducible accesses of one pattern over a working set of four times
+ * 2^c bytes, write_pct in a hundred of them writes. The Zipfian hot set
+ * ranks the words of the working set with exponent 1 and scatters the
+ * ranks, and the pointer chase follows one random cycle through all the
+ * blocks.
+ */
+static void synthesize(std::vector<access_t>& accesses, size_t n, uint64_t c, char gen,
+                       unsigned write_pct) {
+    uint64_t x = 0x2545f4914f6cdd1dULL, stream = 0;
+    uint64_t span = (uint64_t) 4 << c;
+    uint64_t words = span / 8, nodes = span / 64;
+    std::vector<double> cdf;
+    std::vector<uint64_t> next;
+
+    if(gen == GEN_ZIPF) {
+        double sum = 0;
+        cdf.resize(words);
+        for(uint64_t k = 0; k < words; k++) {
+            cdf[k] = (sum += 1.0 / (k + 1));
+        }
+    } else if(gen == GEN_CHASE) {
+        // Sattolo's shuffle, a single cycle through every node
+        next.resize(nodes);
+        for(uint64_t k = 0; k < nodes; k++) {
+            next[k] = k;
+        }
+        for(uint64_t k = nodes - 1; k > 0; k--) {
+            std::swap(next[k], next[xorshift(&x) % k]);
+        }
+    }
+
+    accesses.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        xorshift(&x);
+        switch(gen) {
+        case GEN_SEQUENTIAL:
+            accesses[i].address = 0x10000000 + (stream += 8) % span;
+            break;
+        case GEN_STRIDED:
+            accesses[i].address = 0x10000000 + (stream += STRIDE_BYTES) % span;
+            break;
+        case GEN_RANDOM:
+            accesses[i].address = 0x40000000 + ((x >> 8) % words) * 8;
+            break;
+        case GEN_ZIPF: {
+            double u = (double) (x >> 11) / (double) (1ULL << 53) * cdf[words - 1];
+            uint64_t rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            accesses[i].address = 0x40000000 + ((rank * 0x9e3779b97f4a7c15ULL) % words) * 8;
+            break;
+        }
+        case GEN_CHASE:
+            stream = next[stream];
+            accesses[i].address = 0x20000000 + stream * 64 + 8;
+            break;
+        default:
+            if(x & 1) {
+                accesses[i].address = 0x10000000 + (stream += 8) % span;
+            } else {
+                accesses[i].address = 0x40000000 + (x >> 8) % span;
+            }
+            break;
+        }
+        accesses[i].rw = ((x >> 33) % 100 < write_pct) ? WRITE : READ;
+    }
+}
+
+/**
+ * Simulate accesses once and return the wall time in seconds.
+ */
+static double run(const std::vector<access_t>& accesses, uint64_t c, uint64_t b, uint64_t s,
+                  uint64_t v, char st, char r, char pf, int generic, cache_stats_t* stats,
+                  uint64_t* host_bytes = NULL) {
+    cache_sim_t* cache = new cache_sim_t();
+    cache->set_prefetcher(pf);
+    cache->setup_cache(c, b, s, v, st, r);
+    cache->select_kernels(generic);
+    memset(stats, 0, sizeof(cache_stats_t));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < accesses.size(); i++) {
+        cache->cache_access(accesses[i].rw, accesses[i].address, stats);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    cache->complete_cache(stats);
+    if(host_bytes) {
+        *host_bytes = cache->host_bytes_resident();
+    }
+    delete cache;
+    return elapsed.count();
+}
+
+static int same_case(const bench_row_t* a, const bench_row_t* b) {
+    return a->gen == b->gen && a->write_pct == b->write_pct && a->config.c == b->config.c &&
+           a->config.b == b->config.b && a->config.s == b->config.s &&
+           a->config.v == b->config.v && a->config.st == b->config.st && a->config.r == b->config.r;
+}
+
+/**
+ * Read the rows of a suite CSV, as the suite prints them.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int read_baseline(const char* path, std::vector<bench_row_t>& rows) {
+    FILE* f = fopen(path, "r");
+    char line[512];
+    bench_row_t row;
+    unsigned long long c, b, s, v;
+
+    if(!f) {
+        perror(path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "%c,%u,%llu,%llu,%llu,%llu,%c,%c,%*u,%lf", &row.gen, &row.write_pct,
+                  &c, &b, &s, &v, &row.config.st, &row.config.r, &row.macc_s) == 9) {
+            row.config.c = c;
+            row.config.b = b;
+            row.config.s = s;
+            row.config.v = v;
+            rows.push_back(row);
+        }
+    }
+    fclose(f);
+    if(rows.empty()) {
+        fprintf(stderr, "%s: no suite rows\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Time cache_access on every suite pattern and geometry, n accesses each,
+ * best of reps runs, and print a CSV row each. Peak RSS is the process
+ * high-water mark so far, host_bytes what the row's tag store touched.
+ * Against baseline, the suite regressed if its throughput, as the
+ * geometric mean of the rows' ratios, dropped by more than tolerance
+ * percent. Rows more than twice that slower are named on stderr.
+ *
+ * @return 0, or 1 if the suite regressed
+ */
+static int run_suite(size_t n, int reps, const std::vector<bench_row_t>& baseline,
+                     double tolerance) {
+    std::vector<access_t> accesses;
+    cache_stats_t stats;
+    struct rusage usage;
+    bench_row_t row;
+    uint64_t host_bytes;
+    double log_ratio = 0;
+    size_t compared = 0;
+    int status = 0;
+
+    printf("gen,write_pct,C,B,S,V,ST,R,accesses,macc_s,ns_access,host_bytes,peak_rss_kb\n");
+    for(size_t g = 0; g < sizeof(suite_gens); g++) {
+        synthesize(accesses, n, DEFAULT_C, suite_gens[g], suite_write_pcts[g]);
+        for(size_t k = 0; k < sizeof(suite_configs) / sizeof(suite_configs[0]); k++) {
+            const sweep_config_t* cfg = &suite_configs[k];
+            double best = 0;
+
+            for(int i = 0; i < reps; i++) {
+                double t = run(accesses, cfg->c, cfg->b, cfg->s, cfg->v, cfg->st, cfg->r,
+                               PREFETCH_NONE, 0, &stats, &host_bytes);
+                if(i == 0 || t < best) {
+                    best = t;
+                }
+            }
+            getrusage(RUSAGE_SELF, &usage);
+            row.gen = suite_gens[g];
+            row.write_pct = suite_write_pcts[g];
+            row.config = *cfg;
+            row.macc_s = n / best / 1e6;
+            printf("%c,%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%c,%c,%zu,%.2f,%.2f,"
+                   "%" PRIu64 ",%ld\n", row.gen, row.write_pct, cfg->c, cfg->b, cfg->s, cfg->v,
+                   cfg->st, cfg->r, n, row.macc_s, best / n * 1e9, host_bytes, usage.ru_maxrss);
+            fflush(stdout);
+
+            for(size_t j = 0; j < baseline.size(); j++) {
+                if(same_case(&row, &baseline[j])) {
+                    double ratio = row.macc_s / baseline[j].macc_s;
+
+                    log_ratio += log(ratio);
+                    compared++;
+                    // one row alone is too noisy to fail on, it is only named
+                    if(ratio < 1 - 2 * tolerance / 100) {
+                        fprintf(stderr, "%c,%u C=%" PRIu64 " B=%" PRIu64 " S=%" PRIu64 " V=%"
+                                PRIu64 " %c %c: %.2f Macc/s, baseline %.2f\n", row.gen,
+                                row.write_pct, cfg->c, cfg->b, cfg->s, cfg->v, cfg->st, cfg->r,
+                                row.macc_s, baseline[j].macc_s);
+                    }
+                }
+            }
+        }
+    }
+    if(compared) {
+        double mean = exp(log_ratio / compared);
+
+        fprintf(stderr, "%zu rows at %.2f times the baseline throughput (geometric mean)\n",
+                compared, mean);
+        if(mean < 1 - tolerance / 100) {
+            status = 1;
+        }
+    } else if(!baseline.empty()) {
+        fprintf(stderr, "no row of the baseline matches the suite\n");
+        status = 1;
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    static const char types[] = { BLOCKING, SUBBLOCKING };
+    static const char policies[] = { LRU, NMRU_FIFO, TREE_PLRU, SRRIP, BRRIP, DRRIP, SHIP };
+    static const char prefetchers[] = { PREFETCH_NEXT_LINE, PREFETCH_STRIDE, PREFETCH_HALF };
+    int opt;
+    uint64_t c = DEFAULT_C;
+    uint64_t b = DEFAULT_B;
+    uint64_t v = DEFAULT_V;
+    size_t n = 0;
+    char gen = GEN_MIX;
+    unsigned write_pct = 25;
+    int suite = 0;
+    int reps = 5;
+    const char* baseline_file = NULL;
+    double tolerance = 15;
+    std::vector<bench_row_t> baseline;
+    const char* trace_file = NULL;
+    std::vector<access_t> accesses;
+    cache_stats_t specialized, generic;
+    int status = 0;
+
+    while(-1 != (opt = getopt(argc, argv, "i:n:c:b:v:g:w:xk:B:T:h"))) {
+        switch(opt) {
+        case 'i':
+            trace_file = optarg;
+            break;
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'c':
+            c = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'v':
+            v = atoi(optarg);
+            break;
+        case 'g':
+            gen = optarg[0];
+            break;
+        case 'w':
+            write_pct = atoi(optarg);
+            break;
+        case 'x':
+            suite = 1;
+            break;
+        case 'k':
+            reps = atoi(optarg);
+            break;
+        case 'B':
+            baseline_file = optarg;
+            break;
+        case 'T':
+            tolerance = atof(optarg);
+            break;
+        case 'h':
+            /* Fall through */
+        default:
+            print_help_and_exit();
+            break;
+        }
+    }
+
+    if(suite) {
+        if(baseline_file && read_baseline(baseline_file, baseline) < 0) {
+            exit(1);
+        }
+        return run_suite(n ? n : 1000000, reps > 0 ? reps : 1, baseline, tolerance);
+    }
+
+    if(trace_file) {
+        static access_t batch[TRACE_BATCH];
+        trace_reader_t trace;
+        size_t got;
+
+        // the kernels are timed SUBBLOCKING too
+        if(trace_open(&trace, trace_file) < 0 || trace_check_block(&trace, b, SUBBLOCKING) < 0) {
+            exit(1);
+        }
+        while((got = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+            accesses.insert(accesses.end(), batch, batch + got);
+        }
+        trace_close(&trace);
+    } else {
+        synthesize(accesses, n ? n : 4000000, c, gen, write_pct);
+    }
+    if(accesses.empty() || b > c) {
+        fprintf(stderr, "nothing to simulate\n");
+        exit(1);
+    }
+
+    printf("ST,R,S,accesses,generic_macc_s,specialized_macc_s,speedup\n");
+    for(int t = 0; t < 2; t++) {
+        for(int p = 0; p < 7; p++) {
+            for(uint64_t s = 0; s <= 6 && b + s <= c; s++) {
+                double tg = run(accesses, c, b, s, v, types[t], policies[p], PREFETCH_NONE, 1,
+                                &generic);
+                double ts = run(accesses, c, b, s, v, types[t], policies[p], PREFETCH_NONE, 0,
+                                &specialized);
+
+                // the kernels must agree exactly, or the numbers mean nothing
+                if(memcmp(&generic, &specialized, sizeof(cache_stats_t))) {
+                    fprintf(stderr, "%c %c S=%" PRIu64 ": generic and specialized kernels differ\n",
+                            types[t], policies[p], s);
+                    status = 1;
+                }
+                printf("%c,%c,%" PRIu64 ",%zu,%.2f,%.2f,%.2f\n", types[t], policies[p], s,
+                       accesses.size(), accesses.size() / tg / 1e6, accesses.size() / ts / 1e6,
+                       tg / ts);
+            }
+        }
+    }
+
+    // what the prefetch queue and detectors cost on top of the access path
+    printf("\nST,P,accesses,macc_s,prefetches,overhead\n");
+    for(int t = 0; t < 2; t++) {
+        double base = run(accesses, c, b, DEFAULT_S, v, types[t], DEFAULT_R, PREFETCH_NONE, 0,
+                          &specialized);
+        for(int p = 0; p < 3; p++) {
+            double tp = run(accesses, c, b, DEFAULT_S, v, types[t], DEFAULT_R, prefetchers[p], 0,
+                            &specialized);
+            printf("%c,%c,%zu,%.2f,%" PRIu64 ",%.2f\n", types[t], prefetchers[p], accesses.size(),
+                   accesses.size() / tp / 1e6, specialized.prefetches, tp / base);
+        }
+    }
+
+    // one access per line leaves the stride prefetcher no slack; it must
+    // still run far enough ahead for some prefetches to arrive in time
+    std::vector<access_t> stream(accesses.size());
+    for(size_t i = 0; i < stream.size(); i++) {
+        stream[i].address = 0x10000000 + (i << b);
+        stream[i].rw = READ;
+    }
+    for(int t = 0; t < 2; t++) {
+        run(stream, c, b, DEFAULT_S, v, types[t], DEFAULT_R, PREFETCH_STRIDE, 0, &specialized);
+        if(!specialized.prefetch_useful) {
+            fprintf(stderr, "%c: no useful stride prefetches on a sequential stream\n", types[t]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,85 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "trace.hpp"
+
+void print_help_and_exit(void) {
+    printf("cachesim-convert [OPTIONS] < traces/file.trace > traces/file.ctr\n");
+    printf("  -i FILE\tText trace to read (default stdin)\n");
+    printf("  -o FILE\tBinary trace to write (default stdout)\n");
+    printf("  -b K\t\tStore addresses at 2^K byte granularity (default 0, exact)\n");
+    printf("  -h\t\tThis helpful output\n");
+    exit(0);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    const char* in_file  = NULL;
+    const char* out_file = NULL;
+    uint64_t block_bits  = 0;
+    FILE* fout = stdout;
+    trace_reader_t trace;
+    trace_writer_t* writer;
+
+    while(-1 != (opt = getopt(argc, argv, "i:o:b:h"))) {
+        switch(opt) {
+        case 'i':
+            in_file = optarg;
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'b':
+            block_bits = atoi(optarg);
+            break;
+        case 'h':
+            /* Fall through */
+        default:
+            print_help_and_exit();
+            break;
+        }
+    }
+
+    if(block_bits >= ADDRESS_SIZE) {
+        fprintf(stderr, "block granularity must be below 2^%d\n", ADDRESS_SIZE);
+        exit(1);
+    }
+    if(trace_open(&trace, in_file) < 0) {
+        exit(1);
+    }
+    if(trace.binary) {
+        fprintf(stderr, "%s: already a binary trace\n", trace.name);
+        exit(1);
+    }
+    if(out_file && !(fout = fopen(out_file, "wb"))) {
+        perror(out_file);
+        exit(1);
+    }
+
+    writer = (trace_writer_t*) malloc(sizeof(trace_writer_t));
+    if(trace_writer_open(writer, fout, block_bits) < 0) {
+        perror(out_file ? out_file : "<stdout>");
+        exit(1);
+    }
+
+    static access_t batch[TRACE_BATCH];
+    size_t n;
+    while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            trace_write(writer, batch[i].rw, batch[i].address);
+        }
+    }
+
+    if(trace_writer_close(writer) != 0 || (fout != stdout && fclose(fout) != 0)) {
+        perror(out_file ? out_file : "<stdout>");
+        exit(1);
+    }
+    fprintf(stderr, "%" PRIu64 " records, %" PRIu64 " -> %" PRIu64 " bytes (%.2f bytes/record)\n",
+            writer->records, trace.bytes, writer->bytes,
+            writer->records ? (double) writer->bytes / writer->records : 0.0);
+
+    trace_close(&trace);
+    free(writer);
+    return 0;
+}
@@ -1,8 +1,29 @@
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <getopt.h>
 #include <unistd.h>
 #include "cachesim.hpp"
+#include "trace.hpp"
+#include "sweep.hpp"
+#include "stackdist.hpp"
+#include "shard.hpp"
+#include "pipeline.hpp"
+#include "hierarchy.hpp"
+#include "sample.hpp"
+#include "classify.hpp"
+#include "multicore.hpp"
+#include "timing.hpp"
+#include "profile.hpp"
+#include "interval.hpp"
+
+// options with only a long name
+static const int OPT_PROFILE = 256;
+static const int OPT_INTERVAL = 257;
+static const int OPT_INTERVAL_FILE = 258;
+static const int OPT_PHASE_THRESHOLD = 259;
 
 void print_help_and_exit(void) {
     printf("cachesim [OPTIONS] < traces/file.trace\n");
@@ -10,14 +31,61 @@ void print_help_and_exit(void) {
     printf("  -b B\t\tSize of each block in bytes is 2^B\n");
     printf("  -s S\t\tNumber of blocks per set is 2^S\n");
     printf("  -t B|SB\tFetch policy\n");
-    printf("  -r L|N\tReplacement policy\n");
+    printf("  -r R\t\tReplacement policy: L (LRU), N (NMRU_FIFO), P (tree PLRU), R (SRRIP),\n");
+    printf("\t\tB (BRRIP), D (DRRIP) or H (SHiP)\n");
     printf("  -v V\t\tNumber of blocks in victim cache\n");
+    printf("  -W b|t\tWrite policy: write-back (default) or write-through\n");
+    printf("  -A a|n\tWrite miss policy: write-allocate (default) or no-write-allocate\n");
+    printf("  -P n|l|s|h\tPrefetcher: none (default), next line, stride, other half (SUBBLOCKING)\n");
+    printf("  -i FILE\tTrace file, text or cachesim-convert binary (default stdin)\n");
+    printf("  -x FILE\tSweep mode: simulate every \"C B S V ST R\" line of FILE in one pass\n");
+    printf("  -j N\t\tWorker threads: per configuration in sweep mode, else per set shard\n");
+    printf("  -d\t\tStack-distance mode: LRU misses of every geometry up to 2^C bytes\n");
+    printf("  -f csv|json\tSweep, stack-distance and interval output format\n");
+    printf("  -H\t\tBack large tag stores with transparent huge pages\n");
+    printf("  -l FILE\tHierarchy mode: one \"C B S V ST R\" level per line of FILE, L1 first\n");
+    printf("  -I i|e|n\tHierarchy inclusion: inclusive, exclusive or NINE (default);\n");
+    printf("  \t\texclusive levels must share one block size\n");
+    printf("  -S K\t\tSampling: simulate 1 in 2^K sets\n");
+    printf("  -p M:W:P\tSampling: of every P accesses warm the tags only until the\n");
+    printf("  \t\tlast W + M, simulate W in full and count M\n");
+    printf("  -V\t\tSampling: also simulate everything and compare\n");
+    printf("  -w N:FILE\tSave a checkpoint to FILE after N accesses, then go on\n");
+    printf("  -R FILE[:N]\tResume from a checkpoint, N overrides the trace offset\n");
+    printf("  -m FILE\tMulti-core mode: one more core running the trace in FILE, with a\n");
+    printf("\t\tprivate -c -b -s -v -t -r cache; the -i trace, if any, is core 0\n");
+    printf("  -L FILE\tMulti-core mode: the shared level, one \"C B S V ST R\" line\n");
+    printf("  -O r|t\tMulti-core interleaving: round-robin (default) or by simulated cycle\n");
+    printf("  -T M[:Q[:I]]\tTiming mode: M MSHRs, a memory queue of Q (default %d), an access\n",
+           DEFAULT_MEMORY_QUEUE);
+    printf("\t\tissued every I cycles (default %d)\n", DEFAULT_ISSUE_INTERVAL);
+    printf("  -M FILE\tClassify misses as compulsory, capacity or conflict and write per set\n");
+    printf("\t\tcounts to FILE as CSV\n");
+    printf("  --profile\tTime parsing, simulation and finalizing of a serial run, with\n");
+    printf("\t\thardware counters where perf_event_open allows\n");
+    printf("  --interval N\tA record of the counters every N accesses of a serial run\n");
+    printf("  --interval-file FILE\n");
+    printf("\t\tWhere interval records go (default stdout)\n");
+    printf("  --phase-threshold T\n");
+    printf("\t\tMark intervals whose miss rate jumps by T from the running rate\n");
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
 
 void print_statistics(cache_stats_t* p_stats);
 
+/**
+ * Check every configuration against the granularity the trace was stored at.
+ */
+static int check_trace(const trace_reader_t* tr, const sweep_config_t* configs, size_t count) {
+    for(size_t k = 0; k < count; k++) {
+        if(trace_check_block(tr, configs[k].b, configs[k].st) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     int opt;
     uint64_t c = DEFAULT_C;
@@ -26,10 +94,45 @@ int main(int argc, char* argv[]) {
     uint64_t v = DEFAULT_V;
     char st    = DEFAULT_ST;
     char r     = DEFAULT_R;
-    FILE* fin  = stdin;
+    char w     = DEFAULT_W;
+    char a     = DEFAULT_A;
+    char pf    = DEFAULT_P;
+    const char* trace_file = NULL;
+    const char* sweep_file = NULL;
+    const char* hierarchy_file = NULL;
+    char inclusion = DEFAULT_INCLUSION;
+    sample_config_t sampling;
+    const char* checkpoint_file = NULL;
+    uint64_t checkpoint_at = 0;
+    const char* restore_file = NULL;
+    const char* resume_at = NULL;
+    const char* sets_file = NULL;
+    std::vector<const char*> core_files;
+    const char* shared_file = NULL;
+    char interleave = DEFAULT_INTERLEAVE;
+    timing_config_t timing;
+    int timed = 0;
+    int profiled = 0;
+    interval_config_t intervals = { 0, NULL, FORMAT_CSV, 0 };
+    unsigned threads = 1;
+    char format = FORMAT_CSV;
+    int stack_distance = 0;
+    int huge_pages = 0;
+    trace_reader_t trace;
+
+    static const struct option long_options[] = {
+        { "profile", no_argument, NULL, OPT_PROFILE },
+        { "interval", required_argument, NULL, OPT_INTERVAL },
+        { "interval-file", required_argument, NULL, OPT_INTERVAL_FILE },
+        { "phase-threshold", required_argument, NULL, OPT_PHASE_THRESHOLD },
+        { NULL, 0, NULL, 0 }
+    };
+
+    memset(&sampling, 0, sizeof(sampling));
 
     /* Read arguments */ 
-    while(-1 != (opt = getopt(argc, argv, "c:b:s:t:i:v:r:h"))) {
+    while(-1 != (opt = getopt_long(argc, argv, "c:b:s:t:i:v:r:W:A:P:x:j:f:dHl:I:S:p:Vw:R:M:m:L:O:T:h",
+                                   long_options, NULL))) {
         switch(opt) {
         case 'c':
             c = atoi(optarg);
@@ -49,12 +152,118 @@ int main(int argc, char* argv[]) {
             v = atoi(optarg);
             break;
         case 'r':
-            if(optarg[0] == LRU || optarg[0] == NMRU_FIFO) {
+            if(replacement_name(optarg[0])) {
                 r = optarg[0];
             }
             break;
+        case 'W':
+            if(optarg[0] == WRITE_BACK || optarg[0] == WRITE_THROUGH) {
+                w = optarg[0];
+            }
+            break;
+        case 'A':
+            if(optarg[0] == WRITE_ALLOCATE || optarg[0] == NO_WRITE_ALLOCATE) {
+                a = optarg[0];
+            }
+            break;
+        case 'P':
+            if(optarg[0] == PREFETCH_NONE || optarg[0] == PREFETCH_NEXT_LINE ||
+               optarg[0] == PREFETCH_STRIDE || optarg[0] == PREFETCH_HALF) {
+                pf = optarg[0];
+            }
+            break;
         case 'i':
-            fin = fopen(optarg, "r");
+            trace_file = optarg;
+            break;
+        case 'x':
+            sweep_file = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'd':
+            stack_distance = 1;
+            break;
+        case 'H':
+            huge_pages = 1;
+            break;
+        case 'l':
+            hierarchy_file = optarg;
+            break;
+        case 'I':
+            if(optarg[0] == INCLUSIVE || optarg[0] == EXCLUSIVE || optarg[0] == NINE) {
+                inclusion = optarg[0];
+            }
+            break;
+        case 'S':
+            sampling.set_bits = atoi(optarg);
+            break;
+        case 'p':
+            if(parse_intervals(optarg, &sampling) < 0) {
+                exit(1);
+            }
+            break;
+        case 'V':
+            sampling.validate = 1;
+            break;
+        case 'w': {
+            char* end;
+            checkpoint_at = strtoull(optarg, &end, 10);
+            if(*end != ':' || !end[1]) {
+                fprintf(stderr, "%s: expected N:FILE\n", optarg);
+                exit(1);
+            }
+            checkpoint_file = end + 1;
+            break;
+        }
+        case 'R': {
+            // a trailing :N is an offset, anything else is part of the name
+            char* colon = strrchr(optarg, ':');
+            restore_file = optarg;
+            if(colon && colon[1] && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+                *colon = '\0';
+                resume_at = colon + 1;
+            }
+            break;
+        }
+        case 'M':
+            sets_file = optarg;
+            break;
+        case 'm':
+            core_files.push_back(optarg);
+            break;
+        case 'L':
+            shared_file = optarg;
+            break;
+        case 'O':
+            if(optarg[0] != INTERLEAVE_ROUND_ROBIN && optarg[0] != INTERLEAVE_TIME) {
+                fprintf(stderr, "%s: expected r or t interleaving\n", optarg);
+                exit(1);
+            }
+            interleave = optarg[0];
+            break;
+        case 'T':
+            if(parse_timing(optarg, &timing) < 0) {
+                exit(1);
+            }
+            timed = 1;
+            break;
+        case OPT_PROFILE:
+            profiled = 1;
+            break;
+        case OPT_INTERVAL:
+            intervals.length = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_INTERVAL_FILE:
+            intervals.path = optarg;
+            break;
+        case OPT_PHASE_THRESHOLD:
+            intervals.threshold = atof(optarg);
+            break;
+        case 'f':
+            if(optarg[0] == FORMAT_CSV || optarg[0] == FORMAT_JSON) {
+                format = optarg[0];
+            }
             break;
         case 'h':
             /* Fall through */
@@ -64,35 +273,349 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // each of these runs the trace its own way, and only for one configuration
+    int serial_modes = timed + profiled + (intervals.length > 0);
+    int sampled = sampling.set_bits || sampling.period || sampling.validate;
+    int other_mode = sweep_file || hierarchy_file || !core_files.empty() || stack_distance || sampled;
+    if(serial_modes > 1) {
+        fprintf(stderr, "-T, --profile and --interval cannot be combined\n");
+        exit(1);
+    }
+    if(serial_modes && other_mode) {
+        fprintf(stderr, "-T, --profile and --interval only apply to a single configuration, not "
+                        "to sweep, hierarchy, multi-core, stack-distance or sampling mode\n");
+        exit(1);
+    }
+    if((sweep_file || hierarchy_file || stack_distance || sampled) &&
+       (w != DEFAULT_W || a != DEFAULT_A || pf != DEFAULT_P)) {
+        fprintf(stderr, "-W, -A and -P do not apply to sweep, hierarchy, stack-distance or "
+                        "sampling mode\n");
+        exit(1);
+    }
+    if(!core_files.empty() && pf != DEFAULT_P) {
+        fprintf(stderr, "-P does not apply to multi-core mode\n");
+        exit(1);
+    }
+
+    if(sweep_file) {
+        sweep_config_t* configs;
+        cache_stats_t* sweep_stats;
+        size_t count;
+
+        if(read_sweep_configs(sweep_file, &configs, &count) < 0 ||
+           trace_open(&trace, trace_file) < 0 || check_trace(&trace, configs, count) < 0) {
+            exit(1);
+        }
+        sweep_stats = (cache_stats_t*) calloc(count, sizeof(cache_stats_t));
+        run_sweep(&trace, configs, count, threads, sweep_stats);
+        trace_close(&trace);
+        print_sweep(stdout, format, configs, sweep_stats, count);
+        free(sweep_stats);
+        free(configs);
+        return 0;
+    }
+
+    if(hierarchy_file) {
+        sweep_config_t* configs;
+        size_t count;
+        static access_t batch[TRACE_BATCH];
+        size_t n;
+
+        if(read_sweep_configs(hierarchy_file, &configs, &count) < 0 || count == 0 ||
+           trace_open(&trace, trace_file) < 0 || check_trace(&trace, configs, count) < 0) {
+            exit(1);
+        }
+        hierarchy_t* hier = new hierarchy_t();
+        if(hier->setup(configs, count, inclusion) < 0) {
+            exit(1);
+        }
+        while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+            hier->access_batch(batch, n);
+        }
+        trace_close(&trace);
+        hier->complete();
+
+        for(size_t k = 0; k < count; k++) {
+            printf("Level %zu: C=%" PRIu64 " B=%" PRIu64 " S=%" PRIu64 " V=%" PRIu64 " %s %s\n",
+                   k + 1, configs[k].c, configs[k].b, configs[k].s, configs[k].v,
+                   configs[k].st == BLOCKING ? "BLOCKING" : "SUBBLOCKING",
+                   replacement_name(configs[k].r));
+            print_statistics((cache_stats_t*) hier->level_stats(k));
+            printf("Writebacks: %" PRIu64 "\n", hier->level_stats(k)->writebacks);
+            printf("Writebacks received: %" PRIu64 "\n\n", hier->writebacks_received(k));
+        }
+        printf("Inclusion: %s\n", inclusion == INCLUSIVE ? "INCLUSIVE" :
+                                   inclusion == EXCLUSIVE ? "EXCLUSIVE" : "NINE");
+        printf("Memory reads: %" PRIu64 "\n", hier->memory_reads());
+        printf("Memory writes: %" PRIu64 "\n", hier->memory_writes());
+        printf("Hierarchy AAT: %f\n", hier->avg_access_time());
+        delete hier;
+        free(configs);
+        return 0;
+    }
+
+    if(!core_files.empty()) {
+        sweep_config_t core = { c, b, s, v, st, r };
+        sweep_config_t* shared;
+        size_t count;
+
+        if(!shared_file) {
+            fprintf(stderr, "multi-core mode needs the shared level, -L FILE\n");
+            exit(1);
+        }
+        if(trace_file) {
+            core_files.insert(core_files.begin(), trace_file);
+        }
+        if(b + s > c || read_sweep_configs(shared_file, &shared, &count) < 0) {
+            exit(1);
+        }
+        if(count != 1) {
+            fprintf(stderr, "%s: the shared level is one configuration line, not %zu\n",
+                    shared_file, count);
+            exit(1);
+        }
+        multicore_t* mc = new multicore_t();
+        if(mc->setup(&core_files[0], core_files.size(), &core, w, a, shared, interleave) < 0) {
+            exit(1);
+        }
+        mc->run(threads);
+        mc->complete();
+
+        uint64_t invalidations = 0;
+        for(unsigned k = 0; k < mc->core_count(); k++) {
+            const coherence_stats_t* coherence = mc->core_coherence(k);
+
+            printf("Core %u: %s\n", k, core_files[k]);
+            print_statistics((cache_stats_t*) mc->core_stats(k));
+            printf("Writebacks: %" PRIu64 "\n", mc->core_stats(k)->writebacks);
+            printf("Upgrades: %" PRIu64 "\n", coherence->upgrades);
+            printf("Invalidations: %" PRIu64 "\n", coherence->invalidations);
+            printf("Downgrades: %" PRIu64 "\n", coherence->downgrades);
+            printf("Shared fetches: %" PRIu64 "\n\n", coherence->shared_fetches);
+            invalidations += coherence->invalidations;
+        }
+        printf("Shared level: C=%" PRIu64 " B=%" PRIu64 " S=%" PRIu64 " V=%" PRIu64 " %s %s\n",
+               shared[0].c, shared[0].b, shared[0].s, shared[0].v,
+               shared[0].st == BLOCKING ? "BLOCKING" : "SUBBLOCKING",
+               replacement_name(shared[0].r));
+        print_statistics((cache_stats_t*) mc->shared_stats());
+        printf("Writebacks: %" PRIu64 "\n", mc->shared_stats()->writebacks);
+        printf("Bytes Read From Memory: %" PRIu64 "\n", mc->shared_stats()->bytes_read);
+        printf("Bytes Written To Memory: %" PRIu64 "\n", mc->shared_stats()->bytes_written);
+        printf("Interleaving: %s\n", interleave == INTERLEAVE_TIME ? "TIME" : "ROUND_ROBIN");
+        printf("Total invalidations: %" PRIu64 "\n", invalidations);
+        delete mc;
+        free(shared);
+        return 0;
+    }
+
+    if(stack_distance) {
+        stack_dist_t* sd = new stack_dist_t();
+        static access_t batch[TRACE_BATCH];
+        size_t n;
+
+        if(b > c || trace_open(&trace, trace_file) < 0 ||
+           trace_check_block(&trace, b, BLOCKING) < 0) {
+            exit(1);
+        }
+        sd->setup(c, b);
+        while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+            for(size_t i = 0; i < n; i++) {
+                sd->access(batch[i].rw, batch[i].address);
+            }
+        }
+        trace_close(&trace);
+        sd->print(stdout, format);
+        delete sd;
+        return 0;
+    }
+
     printf("Cache Settings\n");
     printf("C: %" PRIu64 "\n", c);
     printf("B: %" PRIu64 "\n", b);
     printf("S: %" PRIu64 "\n", s);
     printf("V: %" PRIu64 "\n", v);
     printf("F: %s\n", st == BLOCKING ? "BLOCKING" : "SUBBLOCKING");
-    printf("R: %s\n", r == LRU ? "LRU" : "NMRU_FIFO");
+    printf("R: %s\n", replacement_name(r));
     printf("\n");
 
+    if(trace_open(&trace, trace_file) < 0 || trace_check_block(&trace, b, st) < 0) {
+        exit(1);
+    }
+
+    if(sampling.set_bits || sampling.period || sampling.validate) {
+        sweep_config_t geometry = { c, b, s, v, st, r };
+        sample_result_t result;
+
+        if(sampling.set_bits > c - b - s) {
+            fprintf(stderr, "cannot sample 1 in 2^%" PRIu64 " of 2^%" PRIu64 " sets\n",
+                    sampling.set_bits, c - b - s);
+            exit(1);
+        }
+        run_sampled(&trace, &geometry, &sampling, &result);
+        trace_close(&trace);
+
+        print_statistics(&result.estimate);
+        printf("Warmed accesses: %" PRIu64 "\n", result.warmed);
+        printf("Simulated accesses: %" PRIu64 "\n", result.simulated);
+        printf("Measured accesses: %" PRIu64 "\n", result.measured);
+        if(!result.measured) {
+            fprintf(stderr, "no accesses measured, is the trace shorter than one period?\n");
+        }
+        if(result.miss_rate_ci < 0) {
+            printf("Miss rate 95%% CI: unknown, fewer than two clusters measured\n");
+        } else {
+            printf("Miss rate 95%% CI: +/-%f\n", result.miss_rate_ci);
+            printf("AAT 95%% CI: +/-%f\n", result.aat_ci);
+        }
+        if(sampling.validate) {
+            double error = result.estimate.miss_rate - result.full.miss_rate;
+            printf("Full miss rate: %f\n", result.full.miss_rate);
+            printf("Full AAT: %f\n", result.full.avg_access_time);
+            printf("Miss rate error: %f", error);
+            if(result.miss_rate_ci >= 0) {
+                printf(" (%s the CI)", fabs(error) <= result.miss_rate_ci ? "within" : "outside");
+            }
+            printf("\n");
+        }
+        return 0;
+    }
+
     /* Setup the cache */
-    setup_cache(c, b, s, v, st, r);
+    cache_sim_t* cache = new cache_sim_t();
+    cache->use_huge_pages(huge_pages);
+    cache->set_write_policy(w, a);
+    cache->set_prefetcher(pf);
+    cache->setup_cache(c, b, s, v, st, r);
+
+    miss_classifier_t* classifier = NULL;
+    if(sets_file) {
+        classifier = new miss_classifier_t();
+        classifier->setup(c, b, s, st);
+        cache->set_classifier(classifier);
+    }
 
     /* Setup statistics */
     cache_stats_t stats;
     memset(&stats, 0, sizeof(cache_stats_t));
 
+    /* Resume from and save warm state, at positions in this trace */
+    uint64_t position = 0;
+    if(restore_file) {
+        if(cache->restore_checkpoint(restore_file, &stats, &position) < 0) {
+            exit(1);
+        }
+        if(resume_at) {
+            position = strtoull(resume_at, NULL, 10);
+        }
+        if(trace_skip(&trace, position) < position) {
+            fprintf(stderr, "%s: trace ends before access %" PRIu64 "\n", restore_file, position);
+            exit(1);
+        }
+        if(classifier) {
+            fprintf(stderr, "the miss classifier starts cold, misses restored are not classified\n");
+        }
+    }
+    if(checkpoint_file) {
+        static access_t batch[TRACE_BATCH];
+        size_t n;
+
+        while(position < checkpoint_at &&
+              (n = trace_read(&trace, batch, checkpoint_at - position < TRACE_BATCH ?
+                                             checkpoint_at - position : TRACE_BATCH)) > 0) {
+            cache->cache_access_batch(batch, n, &stats);
+            position += n;
+        }
+        if(cache->save_checkpoint(checkpoint_file, &stats, position) < 0) {
+            exit(1);
+        }
+    }
+
+    if(threads > 1 && !serial_modes && !cache->shardable()) {
+        fprintf(stderr, "SUBBLOCKING, no-write-allocate, prefetching, BRRIP, DRRIP, SHIP and -M "
+                        "need the sets in trace order, simulating serially\n");
+        threads = 1;
+    }
+
     /* Begin reading the file */ 
-    char rw;
-    uint64_t address;
-    while (!feof(fin)) { 
-        int ret = fscanf(fin, "%c %" PRIx64 "\n", &rw, &address); 
-        if(ret == 2) {
-            cache_access(rw, address, &stats); 
+    timing_stats_t timing_stats;
+    profile_t profile;
+    if(timed) {
+        // the timing model follows the accesses one at a time, in order
+        run_timed(&trace, cache, &timing, &stats, &timing_stats);
+    } else if(profiled) {
+        // serial, so reading and simulating take turns and can be timed apart
+        profile_open(&profile);
+        run_profiled(&trace, cache, &stats, &profile);
+    } else if(intervals.length) {
+        intervals.format = format;
+        if(run_intervals(&trace, cache, &intervals, &stats) < 0) {
+            exit(1);
         }
+    } else if(threads > 1) {
+        run_sharded(&trace, cache, threads, &stats);
+    } else {
+        run_pipelined(&trace, cache, &stats);
     }
+    trace_close(&trace);
 
-    complete_cache(&stats);
+    if(profiled) {
+        complete_profiled(cache, &stats, &profile);
+    } else {
+        cache->complete_cache(&stats);
+    }
 
     print_statistics(&stats);
+    printf("Host Bytes Per Line: %f\n", cache->host_bytes_per_line());
+    printf("Host Memory Used: %" PRIu64 "\n", cache->host_bytes_resident());
+    printf("Fast Path Fraction: %f\n", (double) stats.fast_hits / stats.accesses);
+    printf("Write Policy: %s %s\n", w == WRITE_BACK ? "WRITE_BACK" : "WRITE_THROUGH",
+           a == WRITE_ALLOCATE ? "WRITE_ALLOCATE" : "NO_WRITE_ALLOCATE");
+    printf("Writebacks: %" PRIu64 "\n", stats.writebacks);
+    printf("Bytes Read From Memory: %" PRIu64 "\n", stats.bytes_read);
+    printf("Bytes Written To Memory: %" PRIu64 "\n", stats.bytes_written);
+    printf("AAT With Write Traffic: %f\n", stats.traffic_access_time);
+    if(pf != PREFETCH_NONE) {
+        printf("Prefetcher: %s\n", pf == PREFETCH_NEXT_LINE ? "NEXT_LINE" :
+                                    pf == PREFETCH_STRIDE ? "STRIDE" : "HALF");
+        printf("Prefetches: %" PRIu64 "\n", stats.prefetches);
+        printf("Prefetches useful: %" PRIu64 "\n", stats.prefetch_useful);
+        printf("Prefetches useless: %" PRIu64 "\n", stats.prefetch_useless);
+        printf("Prefetches late: %" PRIu64 "\n", stats.prefetch_late);
+        printf("Prefetches dropped: %" PRIu64 "\n", stats.prefetch_dropped);
+        printf("Pollution misses: %" PRIu64 "\n", stats.prefetch_pollution);
+        printf("Prefetch accuracy: %f\n", stats.prefetch_accuracy);
+        printf("Prefetch coverage: %f\n", stats.prefetch_coverage);
+    }
+    if(timed) {
+        printf("MSHRs: %" PRIu64 "\n", timing.mshrs);
+        printf("Memory queue: %" PRIu64 "\n", timing.queue);
+        printf("Issue interval: %" PRIu64 "\n", timing.interval);
+        printf("Cycles: %" PRIu64 "\n", timing_stats.cycles);
+        printf("Stall cycles: %" PRIu64 "\n", timing_stats.stall_cycles);
+        printf("Primary misses: %" PRIu64 "\n", timing_stats.primary_misses);
+        printf("Secondary misses: %" PRIu64 "\n", timing_stats.secondary_misses);
+        printf("MSHR full stalls: %" PRIu64 "\n", timing_stats.mshr_stalls);
+        printf("Memory queue full stalls: %" PRIu64 "\n", timing_stats.queue_stalls);
+        printf("Effective AAT: %f\n", timing_stats.effective_aat);
+        printf("MLP: %f\n", timing_stats.mlp);
+        for(uint64_t k = 0; k <= timing.mshrs; k++) {
+            printf("MSHRs busy %" PRIu64 ": %" PRIu64 " cycles\n", k, timing_stats.occupancy[k]);
+        }
+    }
+    if(profiled) {
+        print_profile(stdout, &profile);
+    }
+    if(classifier) {
+        printf("Compulsory misses: %" PRIu64 "\n", stats.compulsory_misses);
+        printf("Capacity misses: %" PRIu64 "\n", stats.capacity_misses);
+        printf("Conflict misses: %" PRIu64 "\n", stats.conflict_misses);
+        if(classifier->write_sets(sets_file) < 0) {
+            exit(1);
+        }
+        delete classifier;
+    }
+    delete cache;
 
     return 0;
 }
@@ -0,0 +1,138 @@
+#include "classify.hpp"
+
+/**
+ * Set up for a cache of 2^c bytes in 2^b byte blocks and 2^s ways, with
+ * storage policy st.
+ */
+void miss_classifier_t::setup(uint64_t c, uint64_t b, uint64_t s, char st) {
+	uint64_t units;
+
+	unit_bits = ((st == SUBBLOCKING) && b) ? b - 1 : b;
+	units = (uint64_t) 1 << (c - unit_bits);
+	if (units >= SHADOW_NONE) {
+		fprintf(stderr, "cannot classify the misses of 2^%" PRIu64 " lines\n", c - b);
+		exit(1);
+	}
+	seen.clear();
+	where.clear();
+	where.reserve(units);
+	unit_of.assign(units, 0);
+	prev.assign(units, SHADOW_NONE);
+	next.assign(units, SHADOW_NONE);
+	head = SHADOW_NONE;
+	tail = SHADOW_NONE;
+	used = 0;
+	sets.assign((uint64_t) 1 << (c - b - s), set_counts_t());
+}
+
+/**
+ * Access unit in the fully associative shadow cache, replacing its LRU
+ * unit when it is full.
+ *
+ * @return 1 if the shadow cache held unit
+ */
+int miss_classifier_t::shadow_touch(uint64_t unit) {
+	std::unordered_map<uint64_t, uint32_t>::iterator it = where.find(unit);
+	int hit = (it != where.end());
+	uint32_t slot;
+
+	if (!hit && (used < unit_of.size())) {
+		slot = used++;
+		where[unit] = slot;
+	} else {
+		if (hit) {
+			slot = it->second;
+			if (slot == tail) {
+				return 1;
+			}
+		} else {
+			slot = head;
+			where.erase(unit_of[slot]);
+			where[unit] = slot;
+		}
+		// unlink, the slot goes back on at the MRU end
+		if (prev[slot] != SHADOW_NONE) {
+			next[prev[slot]] = next[slot];
+		} else {
+			head = next[slot];
+		}
+		if (next[slot] != SHADOW_NONE) {
+			prev[next[slot]] = prev[slot];
+		} else {
+			tail = prev[slot];
+		}
+	}
+	unit_of[slot] = unit;
+	prev[slot] = tail;
+	next[slot] = SHADOW_NONE;
+	if (tail != SHADOW_NONE) {
+		next[tail] = slot;
+	} else {
+		head = slot;
+	}
+	tail = slot;
+	return hit;
+}
+
+/**
+ * Count one access to set index and classify it if it missed.
+ *
+ * @main_hit 1 if the main cache held the block
+ * @missed 1 if the access went to memory
+ * @evicted 1 if the main cache replaced a valid line for it
+ */
+void miss_classifier_t::record(uint64_t address, uint64_t index, int main_hit, int missed,
+                               int evicted, cache_stats_t *p_stats) {
+	uint64_t unit = address >> unit_bits;
+	set_counts_t *set = &sets[index];
+	int shadow_hit, first = 0;
+
+	shadow_hit = shadow_touch(unit);
+	if (!shadow_hit) {
+		first = seen.insert(unit).second;
+	}
+
+	set->accesses++;
+	set->evictions += evicted;
+	set->victim_hits += !main_hit && !missed;
+	if (!missed) {
+		return;
+	}
+	set->misses++;
+	if (first) {
+		set->compulsory++;
+		p_stats->compulsory_misses++;
+	} else if (!shadow_hit) {
+		set->capacity++;
+		p_stats->capacity_misses++;
+	} else {
+		set->conflict++;
+		p_stats->conflict_misses++;
+	}
+}
+
+/**
+ * Write the per set counts to path as CSV, one row per set.
+ *
+ * @return 0 on success, -1 on error
+ */
+int miss_classifier_t::write_sets(const char *path) const {
+	FILE *out = fopen(path, "w");
+	size_t k;
+
+	if (!out) {
+		perror(path);
+		return -1;
+	}
+	fprintf(out, "set,accesses,misses,evictions,victim_hits,compulsory,capacity,conflict\n");
+	for (k=0; k<sets.size(); k++) {
+		fprintf(out, "%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		        ",%" PRIu64 "\n", k, sets[k].accesses, sets[k].misses, sets[k].evictions,
+		        sets[k].victim_hits, sets[k].compulsory, sets[k].capacity, sets[k].conflict);
+	}
+	if (fclose(out) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
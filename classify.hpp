@@ -0,0 +1,56 @@
+#ifndef CLASSIFY_HPP
+#define CLASSIFY_HPP
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cachesim.hpp"
+
+#define SHADOW_NONE UINT32_MAX
+
+/** What happened in one set, for heatmaps */
+struct set_counts_t {
+	uint64_t accesses;
+	uint64_t misses;       // went to memory, read_misses_combined + write_misses_combined
+	uint64_t evictions;    // valid main cache lines a miss replaced
+	uint64_t victim_hits;  // main cache misses the victim cache caught
+	uint64_t compulsory;
+	uint64_t capacity;
+	uint64_t conflict;
+};
+
+/**
+ * Three-C classification of the misses of one cache_sim_t. A miss on a
+ * block never touched before is compulsory. Otherwise it is a capacity
+ * miss if a fully associative LRU cache of the same capacity, fed the
+ * same accesses, misses too, and a conflict miss if that one hits. For
+ * SUBBLOCKING the unit is the half line, which is what a miss fetches.
+ *
+ * The shadow cache is a hash from block to slot and an intrusive LRU list
+ * over the slots, so every access costs O(1). The simulator only calls
+ * record() when a classifier is attached.
+ */
+class miss_classifier_t {
+public:
+	void setup(uint64_t c, uint64_t b, uint64_t s, char st);
+	void record(uint64_t address, uint64_t index, int main_hit, int missed, int evicted,
+	            cache_stats_t *p_stats);
+	int write_sets(const char *path) const;
+
+private:
+	int shadow_touch(uint64_t unit);
+
+	uint64_t unit_bits;
+	std::unordered_set<uint64_t> seen;
+	// fully associative LRU, head the LRU end
+	std::unordered_map<uint64_t, uint32_t> where;
+	std::vector<uint64_t> unit_of;
+	std::vector<uint32_t> prev;
+	std::vector<uint32_t> next;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t used;
+	std::vector<set_counts_t> sets;
+};
+
+#endif /* CLASSIFY_HPP */
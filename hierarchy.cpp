@@ -0,0 +1,264 @@
+#include "hierarchy.hpp"
+
+hierarchy_t::hierarchy_t() : inclusion(DEFAULT_INCLUSION), reads(0), writes(0), aat(0) {
+}
+
+hierarchy_t::~hierarchy_t() {
+	clear();
+}
+
+void hierarchy_t::clear() {
+	size_t k;
+
+	for (k=0; k<levels.size(); k++) {
+		delete levels[k];
+	}
+	levels.clear();
+	block_bits.clear();
+	stats.clear();
+	received.clear();
+}
+
+/**
+ * Set up count levels from configs, configs[0] the level next to the core.
+ *
+ * @inclusion INCLUSIVE, EXCLUSIVE or NINE, applied to every level below
+ *            the first
+ * @return 0 on success, -1 if the levels cannot have that inclusion
+ */
+int hierarchy_t::setup(const sweep_config_t *configs, size_t count, char inclusion) {
+	cache_stats_t zero;
+	size_t k;
+
+	clear();
+	// a line moving between exclusive levels has to be one block in both
+	for (k=1; (inclusion == EXCLUSIVE) && (k<count); k++) {
+		if (configs[k].b != configs[0].b) {
+			fprintf(stderr, "exclusive levels need one block size, level 1 has B=%" PRIu64
+			        " and level %zu B=%" PRIu64 "\n", configs[0].b, k + 1, configs[k].b);
+			return -1;
+		}
+	}
+	memset(&zero, 0, sizeof(zero));
+	for (k=0; k<count; k++) {
+		levels.push_back(new cache_sim_t());
+		levels[k]->setup_cache(configs[k].c, configs[k].b, configs[k].s, configs[k].v,
+		                       configs[k].st, configs[k].r);
+		block_bits.push_back(configs[k].b);
+		stats.push_back(zero);
+		received.push_back(0);
+	}
+	this->inclusion = inclusion;
+	reads = 0;
+	writes = 0;
+	aat = 0;
+	return 0;
+}
+
+/**
+ * Pass a line that left level k to the level below, or to memory.
+ */
+void hierarchy_t::drop(size_t k, cache_entry_t *dropped, std::vector<hier_event_t> &out) {
+	uint64_t address = dropped->tag << block_bits[k];
+	int last = (k + 1 == levels.size());
+	int was_dirty = dropped->dirty;
+	cache_entry_t copy;
+	hier_event_t ev;
+	uint64_t j, u, span, base;
+
+	if ((inclusion == INCLUSIVE) && (k > 0)) {
+		// every copy above goes too, a dirty one makes the whole line dirty
+		for (j=0; j<k; j++) {
+			span = (block_bits[k] > block_bits[j]) ? (1ULL << (block_bits[k] - block_bits[j])) : 1;
+			base = (address >> block_bits[j]) << block_bits[j];
+			for (u=0; u<span; u++) {
+				if (levels[j]->invalidate(base + (u << block_bits[j]), &copy) && copy.dirty) {
+					dropped->dirty = 1;
+				}
+			}
+		}
+	}
+
+	// the level counted the writeback of a line that was dirty already
+	if (dropped->dirty && !was_dirty) {
+		stats[k].writebacks++;
+		stats[k].bytes_written += (uint64_t) 1 << block_bits[k];
+	}
+	if (last) {
+		writes += dropped->dirty;
+		return;
+	}
+	if (inclusion == EXCLUSIVE) {
+		// clean or dirty, the line moves down a level
+		ev.rw = dropped->dirty ? WRITE : READ;
+		ev.kind = HIER_INSERT;
+	} else if (dropped->dirty) {
+		ev.rw = WRITE;
+		ev.kind = HIER_WRITEBACK;
+	} else {
+		return;
+	}
+	ev.address = address;
+	out.push_back(ev);
+}
+
+/**
+ * Run the events for level k in order and collect what it passes down.
+ */
+void hierarchy_t::run_stage(size_t k, const std::vector<hier_event_t> &in,
+                            std::vector<hier_event_t> &out) {
+	cache_sim_t *level = levels[k];
+	cache_stats_t *p_stats = &stats[k];
+	cache_stats_t scratch;
+	cache_entry_t dropped;
+	hier_event_t fill;
+	int last = (k + 1 == levels.size());
+	size_t i;
+	int hit;
+
+	memset(&scratch, 0, sizeof(scratch));
+	for (i=0; i<in.size(); i++) {
+		const hier_event_t *ev = &in[i];
+
+		if ((inclusion == EXCLUSIVE) && (k > 0) && (ev->kind == HIER_DEMAND)) {
+			// an exclusive level hands a hit to the first level and forgets it
+			p_stats->accesses++;
+			p_stats->reads++;
+			if (level->invalidate(ev->address, &dropped)) {
+				if (dropped.dirty) {
+					levels[0]->mark_dirty(ev->address);
+				}
+				continue;
+			}
+			p_stats->read_misses++;
+			p_stats->read_misses_combined++;
+			hit = 0;
+		} else {
+			// writebacks and insertions are traffic, not accesses of this
+			// level, and allocate without a fetch
+			hit = level->access_level(ev->rw, ev->address,
+			                          (ev->kind == HIER_DEMAND) ? p_stats : &scratch, &dropped);
+			if (ev->kind == HIER_WRITEBACK) {
+				received[k]++;
+			}
+			// what they push out is still this level's traffic
+			p_stats->writebacks += scratch.writebacks;
+			p_stats->bytes_written += scratch.bytes_written;
+			scratch.writebacks = 0;
+			scratch.bytes_written = 0;
+			if (dropped.valid1 || dropped.valid2) {
+				drop(k, &dropped, out);
+			}
+		}
+
+		if (!hit && (ev->kind == HIER_DEMAND)) {
+			if (last) {
+				reads++;
+			} else {
+				fill.rw = READ;
+				fill.kind = HIER_DEMAND;
+				fill.address = ev->address;
+				out.push_back(fill);
+			}
+		}
+	}
+}
+
+/**
+ * Simulate accesses from the core, in order.
+ */
+void hierarchy_t::access_batch(const access_t *accesses, size_t n) {
+	// NINE levels take the whole batch at once, the others one access
+	size_t step = (inclusion == NINE) ? n : 1;
+	size_t i, j, k;
+	hier_event_t ev;
+
+	for (i=0; i<n; i+=step) {
+		streams[0].clear();
+		for (j=i; (j<i+step) && (j<n); j++) {
+			ev.rw = accesses[j].rw;
+			ev.kind = HIER_DEMAND;
+			ev.address = accesses[j].address;
+			streams[0].push_back(ev);
+		}
+		for (k=0; (k<levels.size()) && !streams[0].empty(); k++) {
+			streams[1].clear();
+			run_stage(k, streams[0], streams[1]);
+			streams[0].swap(streams[1]);
+		}
+	}
+}
+
+/**
+ * Complete every level and fold their access times into one, each level's
+ * misses paying for the access time of the level below. The dirty lines a
+ * level still holds at the end go down the hierarchy before the level below
+ * completes, and the last level's go to memory. Only demand accesses count
+ * towards the access times. The last level's own miss penalty stands for
+ * memory.
+ */
+void hierarchy_t::complete() {
+	std::vector<uint64_t> dirty;
+	uint64_t flushed = 0;
+	hier_event_t ev;
+	size_t k, j, i;
+
+	for (k=0; k<levels.size(); k++) {
+		dirty.clear();
+		if (k + 1 < levels.size()) {
+			levels[k]->dirty_blocks(&dirty);
+		}
+		// counted as this level's writebacks, and clean from here on
+		flushed = stats[k].writebacks;
+		levels[k]->complete_cache(&stats[k]);
+		flushed = stats[k].writebacks - flushed;
+
+		streams[0].clear();
+		for (i=0; i<dirty.size(); i++) {
+			ev.rw = WRITE;
+			ev.kind = (inclusion == EXCLUSIVE) ? HIER_INSERT : HIER_WRITEBACK;
+			ev.address = dirty[i];
+			streams[0].push_back(ev);
+		}
+		for (j=k + 1; (j<levels.size()) && !streams[0].empty(); j++) {
+			streams[1].clear();
+			run_stage(j, streams[0], streams[1]);
+			streams[0].swap(streams[1]);
+		}
+	}
+	// the dirty lines the last level flushed go to memory
+	writes += flushed;
+	aat = levels.empty() ? 0 : stats[levels.size() - 1].avg_access_time;
+	for (k=levels.size(); k-->1;) {
+		// a level nothing missed in has no access time of its own to add
+		if (stats[k - 1].miss_rate > 0) {
+			aat = stats[k - 1].hit_time + (stats[k - 1].miss_rate * aat);
+		} else {
+			aat = stats[k - 1].hit_time;
+		}
+	}
+}
+
+size_t hierarchy_t::depth() const {
+	return levels.size();
+}
+
+const cache_stats_t *hierarchy_t::level_stats(size_t k) const {
+	return &stats[k];
+}
+
+uint64_t hierarchy_t::writebacks_received(size_t k) const {
+	return received[k];
+}
+
+uint64_t hierarchy_t::memory_reads() const {
+	return reads;
+}
+
+uint64_t hierarchy_t::memory_writes() const {
+	return writes;
+}
+
+double hierarchy_t::avg_access_time() const {
+	return aat;
+}
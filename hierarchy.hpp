@@ -0,0 +1,73 @@
+#ifndef HIERARCHY_HPP
+#define HIERARCHY_HPP
+
+#include <vector>
+#include "cachesim.hpp"
+#include "sweep.hpp"
+
+static const char     INCLUSIVE = 'i';
+static const char     EXCLUSIVE = 'e';
+static const char     NINE = 'n';
+static const char     DEFAULT_INCLUSION = NINE;
+
+/** What one level hands to the level below it */
+struct hier_event_t {
+	char     rw;
+	char     kind;     // HIER_DEMAND, HIER_WRITEBACK or HIER_INSERT
+	uint64_t address;
+};
+
+// a miss the level below has to supply
+static const char     HIER_DEMAND = 'd';
+// a dirty line written back, allocated below without a fetch
+static const char     HIER_WRITEBACK = 'w';
+// a line an exclusive level evicted into the one below, not an access
+static const char     HIER_INSERT = 'i';
+
+/**
+ * Any number of cache levels, the first one closest to the core. Each
+ * level is a cache_sim_t with its own victim cache, and only sees the
+ * miss and writeback stream of the level above.
+ *
+ * NINE levels never act on the levels above them, so a whole batch runs
+ * through each level in turn. Inclusive levels invalidate the lines they
+ * drop from every level above, and exclusive levels hand a hit up and
+ * take the evictions of the level above; both feed back upwards, so
+ * their accesses go down the hierarchy one at a time.
+ */
+class hierarchy_t {
+public:
+	hierarchy_t();
+	~hierarchy_t();
+
+	int setup(const sweep_config_t *configs, size_t count, char inclusion);
+	void access_batch(const access_t *accesses, size_t n);
+	void complete();
+
+	size_t depth() const;
+	const cache_stats_t *level_stats(size_t k) const;
+	uint64_t writebacks_received(size_t k) const;
+	uint64_t memory_reads() const;
+	uint64_t memory_writes() const;
+	double avg_access_time() const;
+
+private:
+	hierarchy_t(const hierarchy_t &);
+	hierarchy_t &operator=(const hierarchy_t &);
+
+	void run_stage(size_t k, const std::vector<hier_event_t> &in, std::vector<hier_event_t> &out);
+	void drop(size_t k, cache_entry_t *dropped, std::vector<hier_event_t> &out);
+	void clear();
+
+	std::vector<cache_sim_t *> levels;
+	std::vector<uint64_t> block_bits;
+	std::vector<cache_stats_t> stats;     // demand accesses only
+	std::vector<uint64_t> received;       // writebacks from the level above
+	std::vector<hier_event_t> streams[2];
+	char inclusion;
+	uint64_t reads;
+	uint64_t writes;
+	double aat;
+};
+
+#endif /* HIERARCHY_HPP */
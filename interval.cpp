@@ -0,0 +1,188 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "interval.hpp"
+#include "sweep.hpp"
+
+/** Counters of one interval, and the state of the cache at its end */
+struct interval_record_t {
+	uint64_t end;          // accesses simulated by the end of the interval
+	uint64_t accesses;
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t main_misses;  // missed in the main cache
+	uint64_t misses;       // missed in the victim cache too
+	uint64_t writebacks;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	double   occupancy;         // share of main cache lines valid
+	double   victim_occupancy;
+	int      phase;        // the miss rate jumped, a new phase starts here
+};
+
+static void write_record(FILE *out, char format, const interval_record_t *rec) {
+	double miss_rate = rec->accesses ? (double) rec->misses / rec->accesses : 0;
+	double victim_hit_rate = rec->main_misses ?
+	                         (double) (rec->main_misses - rec->misses) / rec->main_misses : 0;
+
+	if (format == FORMAT_JSON) {
+		fprintf(out, "{\"end\":%" PRIu64 ",\"accesses\":%" PRIu64 ",\"reads\":%" PRIu64
+		        ",\"writes\":%" PRIu64 ",\"misses\":%" PRIu64 ",\"victim_hits\":%" PRIu64
+		        ",\"writebacks\":%" PRIu64 ",\"bytes_read\":%" PRIu64 ",\"bytes_written\":%"
+		        PRIu64 ",\"miss_rate\":%f,\"victim_hit_rate\":%f,\"occupancy\":%f,"
+		        "\"victim_occupancy\":%f,\"phase\":%s}\n", rec->end, rec->accesses, rec->reads,
+		        rec->writes, rec->misses, rec->main_misses - rec->misses, rec->writebacks,
+		        rec->bytes_read, rec->bytes_written, miss_rate, victim_hit_rate, rec->occupancy,
+		        rec->victim_occupancy, rec->phase ? "true" : "false");
+		return;
+	}
+	fprintf(out, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%"
+	        PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%f,%f,%f,%d\n", rec->end, rec->accesses,
+	        rec->reads, rec->writes, rec->misses, rec->main_misses - rec->misses,
+	        rec->writebacks, rec->bytes_read, rec->bytes_written, miss_rate, victim_hit_rate,
+	        rec->occupancy, rec->victim_occupancy, rec->phase);
+}
+
+/**
+ * Fill rec with what changed since last, then make last the current counters.
+ */
+static void take_record(cache_sim_t *sim, const cache_stats_t *now, cache_stats_t *last,
+                        interval_record_t *rec) {
+	rec->end = now->accesses;
+	rec->accesses = now->accesses - last->accesses;
+	rec->reads = now->reads - last->reads;
+	rec->writes = now->writes - last->writes;
+	rec->main_misses = (now->read_misses + now->write_misses) -
+	                   (last->read_misses + last->write_misses);
+	rec->misses = (now->read_misses_combined + now->write_misses_combined) -
+	              (last->read_misses_combined + last->write_misses_combined);
+	rec->writebacks = now->writebacks - last->writebacks;
+	rec->bytes_read = now->bytes_read - last->bytes_read;
+	rec->bytes_written = now->bytes_written - last->bytes_written;
+	sim->occupancy(&rec->occupancy, &rec->victim_occupancy);
+	rec->phase = 0;
+	*last = *now;
+}
+
+/**
+ * Mark rec as the start of a phase if its miss rate is cfg->threshold or
+ * more away from the running rate, and fold it into that rate.
+ */
+static void detect_phase(const interval_config_t *cfg, interval_record_t *rec, double *running) {
+	double rate;
+
+	if ((cfg->threshold <= 0) || !rec->accesses) {
+		return;
+	}
+	rate = (double) rec->misses / rec->accesses;
+	if (*running < 0) {
+		*running = rate;
+	} else if (fabs(rate - *running) >= cfg->threshold) {
+		rec->phase = 1;
+		*running = rate;
+	} else {
+		*running += PHASE_SMOOTHING * (rate - *running);
+	}
+}
+
+/**
+ * Simulate a trace serially and emit a record of the counters every
+ * cfg->length accesses, and one for whatever is left at the end.
+ *
+ * Records are handed to a writer thread, so a slow file or pipe never
+ * holds up the simulation; the records queue up instead. The phase
+ * detector keeps a running miss rate and marks an interval whose miss
+ * rate is cfg->threshold or more away from it, then starts the running
+ * rate over from that interval.
+ *
+ * @return 0 on success, -1 if the records can't be written
+ */
+int run_intervals(trace_reader_t *tr, cache_sim_t *sim, const interval_config_t *cfg,
+                  cache_stats_t *p_stats) {
+	static access_t batch[TRACE_BATCH];
+	std::vector<interval_record_t> pending;
+	std::mutex lock;
+	std::condition_variable posted;
+	cache_stats_t last = *p_stats;
+	interval_record_t rec;
+	uint64_t left = cfg->length;
+	double running = -1;
+	int done = 0, failed;
+	size_t n, i, m;
+	FILE *out;
+
+	out = cfg->path ? fopen(cfg->path, "w") : stdout;
+	if (!out) {
+		perror(cfg->path);
+		return -1;
+	}
+	if (cfg->format != FORMAT_JSON) {
+		fprintf(out, "end,accesses,reads,writes,misses,victim_hits,writebacks,bytes_read,"
+		        "bytes_written,miss_rate,victim_hit_rate,occupancy,victim_occupancy,phase\n");
+	}
+
+	std::thread writer([&]() {
+		std::vector<interval_record_t> taken;
+		size_t k;
+
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				posted.wait(guard, [&]() { return done || !pending.empty(); });
+				if (pending.empty()) {
+					return;
+				}
+				taken.swap(pending);
+			}
+			for (k=0; k<taken.size(); k++) {
+				write_record(out, cfg->format, &taken[k]);
+			}
+			taken.clear();
+		}
+	});
+
+	while ((n = trace_read(tr, batch, TRACE_BATCH)) > 0) {
+		for (i=0; i<n; i+=m) {
+			m = (n - i < left) ? n - i : left;
+			sim->cache_access_batch(batch + i, m, p_stats);
+			left -= m;
+			if (left > 0) {
+				continue;
+			}
+			left = cfg->length;
+			take_record(sim, p_stats, &last, &rec);
+			detect_phase(cfg, &rec, &running);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				pending.push_back(rec);
+			}
+			posted.notify_one();
+		}
+	}
+	if (p_stats->accesses > last.accesses) {
+		take_record(sim, p_stats, &last, &rec);
+		detect_phase(cfg, &rec, &running);
+		std::lock_guard<std::mutex> guard(lock);
+		pending.push_back(rec);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = 1;
+	}
+	posted.notify_one();
+	writer.join();
+	failed = ferror(out);
+	if (out != stdout) {
+		failed |= fclose(out);
+	} else {
+		failed |= fflush(out);
+	}
+	if (failed) {
+		fprintf(stderr, "%s: could not write the interval records\n",
+		        cfg->path ? cfg->path : "<stdout>");
+		return -1;
+	}
+	return 0;
+}
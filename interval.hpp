@@ -0,0 +1,20 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+// weight of the newest interval in the phase detector's running miss rate
+#define PHASE_SMOOTHING 0.25
+
+struct interval_config_t {
+	uint64_t    length;     // accesses per record
+	const char *path;       // records go here, NULL for stdout
+	char        format;     // FORMAT_CSV, or FORMAT_JSON for one object per line
+	double      threshold;  // miss rate jump that starts a phase, 0 for no detector
+};
+
+int run_intervals(trace_reader_t *tr, cache_sim_t *sim, const interval_config_t *cfg,
+                  cache_stats_t *p_stats);
+
+#endif /* INTERVAL_HPP */
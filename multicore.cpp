@@ -0,0 +1,382 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "multicore.hpp"
+
+multicore_t::multicore_t() : block_bits(0), write_policy(DEFAULT_W), allocate_policy(DEFAULT_A),
+                             interleave(DEFAULT_INTERLEAVE), hit_cycles(0), miss_cycles(0) {
+	memset(&llc_stats, 0, sizeof(llc_stats));
+}
+
+multicore_t::~multicore_t() {
+	clear();
+}
+
+void multicore_t::clear() {
+	size_t k;
+
+	for (k=0; k<cores.size(); k++) {
+		trace_close(&cores[k]->trace);
+		delete cores[k];
+	}
+	cores.clear();
+	directory.clear();
+}
+
+/**
+ * Open one trace per core and set up count private levels like core and
+ * the shared level like shared.
+ *
+ * @write, @allocate The write policies of the private levels
+ * @interleave INTERLEAVE_ROUND_ROBIN or INTERLEAVE_TIME
+ * @return 0 on success, -1 if a trace cannot be opened
+ */
+int multicore_t::setup(const char *const *paths, unsigned count, const sweep_config_t *core,
+                       char write, char allocate, const sweep_config_t *shared,
+                       char interleave) {
+	unsigned k;
+
+	clear();
+	if ((count == 0) || (count > MULTICORE_MAX)) {
+		fprintf(stderr, "between 1 and %d cores, not %u\n", MULTICORE_MAX, count);
+		return -1;
+	}
+	for (k=0; k<count; k++) {
+		core_t *c = new core_t();
+
+		cores.push_back(c);
+		if ((trace_open(&c->trace, paths[k]) < 0) ||
+		    (trace_check_block(&c->trace, core->b, core->st) < 0)) {
+			return -1;
+		}
+		c->cache.set_write_policy(write, allocate);
+		c->cache.setup_cache(core->c, core->b, core->s, core->v, core->st, core->r);
+		memset(&c->stats, 0, sizeof(c->stats));
+		memset(&c->coherence, 0, sizeof(c->coherence));
+		c->batch.resize(TRACE_BATCH);
+		c->next = 0;
+		c->n = 0;
+		c->key = 0;
+		c->done = 0;
+	}
+	llc.setup_cache(shared->c, shared->b, shared->s, shared->v, shared->st, shared->r);
+	memset(&llc_stats, 0, sizeof(llc_stats));
+	block_bits = core->b;
+	write_policy = write;
+	allocate_policy = allocate;
+	this->interleave = interleave;
+	hit_cycles = cores[0]->cache.hit_time();
+	miss_cycles = cores[0]->cache.miss_penalty();
+	return 0;
+}
+
+/**
+ * Run core's trace through its private level until its next access is due
+ * at end or later, recording what the shared level has to see.
+ */
+void multicore_t::simulate(core_t *core, uint64_t end) {
+	cache_entry_t dropped;
+	core_event_t ev;
+	const access_t *acc;
+	int hit, allocated;
+
+	while (!core->done && (core->key < end)) {
+		if (core->next == core->n) {
+			core->n = trace_read(&core->trace, &core->batch[0], TRACE_BATCH);
+			core->next = 0;
+			if (core->n == 0) {
+				core->done = 1;
+				break;
+			}
+		}
+		acc = &core->batch[core->next++];
+		hit = core->cache.access_level(acc->rw, acc->address, &core->stats, &dropped);
+
+		ev.key = core->key;
+		ev.hit = hit;
+		ev.dirty = 0;
+		if (dropped.valid1 || dropped.valid2) {
+			ev.kind = CORE_EVICT;
+			ev.address = dropped.tag << block_bits;
+			ev.dirty = dropped.dirty;
+			core->events.push_back(ev);
+			ev.dirty = 0;
+		}
+		ev.address = acc->address;
+		allocated = hit || (acc->rw == READ) || (allocate_policy == WRITE_ALLOCATE);
+		if (!hit && allocated) {
+			ev.kind = CORE_FETCH;
+			core->events.push_back(ev);
+		}
+		if ((acc->rw == WRITE) && allocated) {
+			ev.kind = CORE_WRITE;
+			core->events.push_back(ev);
+		}
+		if ((acc->rw == WRITE) && (!allocated || (write_policy == WRITE_THROUGH))) {
+			ev.kind = CORE_STORE;
+			core->events.push_back(ev);
+		}
+
+		if (interleave == INTERLEAVE_TIME) {
+			core->key += hit ? hit_cycles : hit_cycles + miss_cycles;
+		} else {
+			core->key++;
+		}
+	}
+}
+
+/**
+ * The modified copy of block a core holds goes to the shared level. A
+ * write-through core wrote it there already.
+ */
+void multicore_t::flush(uint64_t block) {
+	cache_entry_t dropped;
+
+	if (write_policy == WRITE_BACK) {
+		llc.access_level(WRITE, block << block_bits, &llc_stats, &dropped);
+	}
+}
+
+/**
+ * Apply one event of core k to the directory and the shared level.
+ */
+void multicore_t::handle(unsigned k, const core_event_t *ev) {
+	uint64_t block = ev->address >> block_bits;
+	uint64_t bit = (uint64_t) 1 << k;
+	uint64_t others;
+	std::unordered_map<uint64_t, dir_entry_t>::iterator it;
+	cache_entry_t dropped;
+	dir_entry_t *d;
+	unsigned o;
+
+	if (ev->kind == CORE_EVICT) {
+		it = directory.find(block);
+		if ((it == directory.end()) || !(it->second.sharers & bit)) {
+			// another core's write took it already, and its data with it
+			return;
+		}
+		if (ev->dirty && it->second.modified) {
+			flush(block);
+		}
+		it->second.sharers &= ~bit;
+		it->second.modified = 0;
+		if (!it->second.sharers) {
+			directory.erase(it);
+		}
+		return;
+	}
+
+	if (ev->kind == CORE_STORE) {
+		it = directory.find(block);
+		if ((it != directory.end()) && !(it->second.sharers & bit)) {
+			// a store that did not allocate leaves no copy but the shared one
+			if (it->second.modified) {
+				flush(block);
+			}
+			for (others=it->second.sharers; others; others&=others - 1) {
+				o = __builtin_ctzll(others);
+				cores[o]->invalidate.insert(block);
+				cores[o]->clean.erase(block);
+				cores[o]->coherence.invalidations++;
+			}
+			directory.erase(it);
+		}
+		llc.access_level(WRITE, ev->address, &llc_stats, &dropped);
+		return;
+	}
+
+	// a core that uses the block again after losing it keeps it
+	cores[k]->invalidate.erase(block);
+	cores[k]->clean.erase(block);
+	d = &directory[block];
+	others = d->sharers & ~bit;
+
+	if (ev->kind == CORE_FETCH) {
+		if (others) {
+			cores[k]->coherence.shared_fetches++;
+		}
+		if (d->modified && others) {
+			// the owner supplies its copy and keeps it shared
+			o = __builtin_ctzll(others);
+			flush(block);
+			d->modified = 0;
+			cores[o]->clean.insert(block);
+			cores[o]->coherence.downgrades++;
+		}
+		llc.access_level(READ, ev->address, &llc_stats, &dropped);
+		d->sharers |= bit;
+		return;
+	}
+
+	// CORE_WRITE
+	if (d->modified && (d->sharers == bit)) {
+		return;
+	}
+	if (ev->hit && (d->sharers & bit)) {
+		cores[k]->coherence.upgrades++;
+	}
+	if (d->modified && others) {
+		flush(block);
+	}
+	while (others) {
+		o = __builtin_ctzll(others);
+		others &= others - 1;
+		cores[o]->invalidate.insert(block);
+		cores[o]->clean.erase(block);
+		cores[o]->coherence.invalidations++;
+	}
+	d->sharers = bit;
+	d->modified = 1;
+}
+
+/**
+ * Feed the events of the last epoch to the shared level in interleaving
+ * order, ties going to the lower core, then apply what they did to the
+ * private levels.
+ */
+void multicore_t::merge() {
+	std::vector<size_t> pos(cores.size(), 0);
+	cache_entry_t line;
+	size_t k, best;
+
+	for (;;) {
+		best = cores.size();
+		for (k=0; k<cores.size(); k++) {
+			if ((pos[k] < cores[k]->events.size()) &&
+			    ((best == cores.size()) ||
+			     (cores[k]->events[pos[k]].key < cores[best]->events[pos[best]].key))) {
+				best = k;
+			}
+		}
+		if (best == cores.size()) {
+			break;
+		}
+		handle(best, &cores[best]->events[pos[best]++]);
+	}
+
+	for (k=0; k<cores.size(); k++) {
+		core_t *c = cores[k];
+		std::unordered_set<uint64_t>::iterator it;
+
+		c->events.clear();
+		for (it=c->invalidate.begin(); it!=c->invalidate.end(); ++it) {
+			c->cache.invalidate(*it << block_bits, &line);
+		}
+		for (it=c->clean.begin(); it!=c->clean.end(); ++it) {
+			c->cache.mark_clean(*it << block_bits);
+		}
+		c->invalidate.clear();
+		c->clean.clear();
+	}
+}
+
+/**
+ * Simulate every trace to its end, the private levels on up to threads
+ * threads. Core k runs on worker k % threads.
+ */
+void multicore_t::run(unsigned threads) {
+	uint64_t step = (interleave == INTERLEAVE_TIME) ? MULTICORE_EPOCH_CYCLES : MULTICORE_EPOCH;
+	uint64_t end = 0, generation = 0;
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable start, finished;
+	unsigned done = 0, t;
+	int stop = 0, running;
+	size_t k;
+
+	if (threads > cores.size()) {
+		threads = cores.size();
+	}
+	for (t=0; (threads > 1) && (t<threads); t++) {
+		workers.push_back(std::thread([&, t]() {
+			uint64_t seen = 0;
+			size_t j;
+
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					start.wait(guard, [&]() { return stop || (generation != seen); });
+					if (stop) {
+						return;
+					}
+					seen = generation;
+				}
+				for (j=t; j<cores.size(); j+=threads) {
+					simulate(cores[j], end);
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				if (++done == threads) {
+					finished.notify_one();
+				}
+			}
+		}));
+	}
+
+	do {
+		end += step;
+		if (workers.empty()) {
+			for (k=0; k<cores.size(); k++) {
+				simulate(cores[k], end);
+			}
+		} else {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				done = 0;
+				generation++;
+			}
+			start.notify_all();
+			std::unique_lock<std::mutex> guard(lock);
+			finished.wait(guard, [&]() { return done == threads; });
+		}
+		merge();
+
+		running = 0;
+		for (k=0; k<cores.size(); k++) {
+			running |= !cores[k]->done;
+		}
+	} while (running);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = 1;
+	}
+	start.notify_all();
+	for (t=0; t<workers.size(); t++) {
+		workers[t].join();
+	}
+}
+
+/**
+ * Complete the private levels, writing the lines they still hold modified
+ * to the shared level, then the shared level.
+ */
+void multicore_t::complete() {
+	std::vector<uint64_t> dirty;
+	size_t k, i;
+
+	for (k=0; k<cores.size(); k++) {
+		dirty.clear();
+		cores[k]->cache.dirty_blocks(&dirty);
+		for (i=0; i<dirty.size(); i++) {
+			flush(dirty[i] >> block_bits);
+		}
+		cores[k]->cache.complete_cache(&cores[k]->stats);
+	}
+	llc.complete_cache(&llc_stats);
+}
+
+unsigned multicore_t::core_count() const {
+	return cores.size();
+}
+
+const cache_stats_t *multicore_t::core_stats(unsigned k) const {
+	return &cores[k]->stats;
+}
+
+const coherence_stats_t *multicore_t::core_coherence(unsigned k) const {
+	return &cores[k]->coherence;
+}
+
+const cache_stats_t *multicore_t::shared_stats() const {
+	return &llc_stats;
+}
@@ -0,0 +1,130 @@
+#ifndef MULTICORE_HPP
+#define MULTICORE_HPP
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cachesim.hpp"
+#include "sweep.hpp"
+#include "trace.hpp"
+
+// the directory keeps one bit per core
+#define MULTICORE_MAX 64
+// accesses per core between two merges with INTERLEAVE_ROUND_ROBIN
+#define MULTICORE_EPOCH 1024
+// simulated cycles per core between two merges with INTERLEAVE_TIME
+#define MULTICORE_EPOCH_CYCLES (16 * MULTICORE_EPOCH)
+
+// access k of every core before access k + 1 of any
+static const char     INTERLEAVE_ROUND_ROBIN = 'r';
+// by the cycle each core reaches an access at, from its own hit time and
+// miss penalty
+static const char     INTERLEAVE_TIME = 't';
+static const char     DEFAULT_INTERLEAVE = INTERLEAVE_ROUND_ROBIN;
+
+/** Coherence traffic of one core */
+struct coherence_stats_t {
+	uint64_t upgrades;        // write hits on lines the core held shared
+	uint64_t invalidations;   // lines another core's write took away
+	uint64_t downgrades;      // modified lines another core's read made shared
+	uint64_t shared_fetches;  // misses on blocks other cores held
+};
+
+/** What a core's private level hands the shared level */
+struct core_event_t {
+	uint64_t key;      // access index or cycle, the interleaving order
+	uint64_t address;
+	char kind;         // CORE_FETCH, CORE_WRITE, CORE_STORE or CORE_EVICT
+	char hit;          // CORE_WRITE: the write hit the private level
+	char dirty;        // CORE_EVICT: the line was modified
+};
+
+// missed the private level, the shared level supplies the block
+static const char     CORE_FETCH = 'f';
+// a write, which needs the block modified in this core alone
+static const char     CORE_WRITE = 'w';
+// a store that goes on to the shared level: written through, or a write
+// miss that does not allocate
+static const char     CORE_STORE = 's';
+// a line left the private level
+static const char     CORE_EVICT = 'e';
+
+/** MSI state of a block across the private levels */
+struct dir_entry_t {
+	uint64_t sharers;  // bit k set if core k holds it
+	int modified;      // the one sharer holds it modified
+};
+
+struct core_t {
+	cache_sim_t cache;
+	cache_stats_t stats;
+	coherence_stats_t coherence;
+	trace_reader_t trace;
+	std::vector<access_t> batch;
+	size_t next;
+	size_t n;
+	uint64_t key;   // of the core's next access
+	int done;
+	std::vector<core_event_t> events;
+	// blocks the merge took away or made shared, applied once it is done
+	std::unordered_set<uint64_t> invalidate;
+	std::unordered_set<uint64_t> clean;
+};
+
+/**
+ * Any number of cores, each with a private cache and victim cache running
+ * its own trace, in front of one shared last level cache and an MSI
+ * directory over the private levels.
+ *
+ * The cores run an epoch at a time, on separate threads, and record their
+ * misses, writes and evictions. The main thread then merges those in
+ * interleaving order into the shared level and the directory, and applies
+ * the invalidations and downgrades they cause before the next epoch. A
+ * core keeps using a line another core took away until then, so shorter
+ * epochs track the serial order more closely; the results do not depend
+ * on the number of threads. The shared level never invalidates the
+ * private ones, it is NINE.
+ *
+ * Write-through private levels send every store on to the shared level,
+ * and their modified lines are never dirty. A write miss that does not
+ * allocate takes the block away from the other cores and writes the
+ * shared level without the core becoming a sharer.
+ */
+class multicore_t {
+public:
+	multicore_t();
+	~multicore_t();
+
+	int setup(const char *const *paths, unsigned count, const sweep_config_t *core,
+	          char write, char allocate, const sweep_config_t *shared, char interleave);
+	void run(unsigned threads);
+	void complete();
+
+	unsigned core_count() const;
+	const cache_stats_t *core_stats(unsigned k) const;
+	const coherence_stats_t *core_coherence(unsigned k) const;
+	const cache_stats_t *shared_stats() const;
+
+private:
+	multicore_t(const multicore_t &);
+	multicore_t &operator=(const multicore_t &);
+
+	void simulate(core_t *core, uint64_t end);
+	void merge();
+	void handle(unsigned k, const core_event_t *ev);
+	void flush(uint64_t block);
+	void clear();
+
+	std::vector<core_t *> cores;
+	cache_sim_t llc;
+	cache_stats_t llc_stats;
+	std::unordered_map<uint64_t, dir_entry_t> directory;
+	uint64_t block_bits;
+	char write_policy;     // of the private levels
+	char allocate_policy;
+	char interleave;
+	uint64_t hit_cycles;
+	uint64_t miss_cycles;
+};
+
+#endif /* MULTICORE_HPP */
@@ -0,0 +1,60 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pipeline.hpp"
+
+struct pipeline_slot_t {
+	access_t accesses[PIPELINE_BATCH];
+	size_t n;                          // 0 marks the end of the trace
+};
+
+/**
+ * Simulate one configuration with reading and parsing on a thread of their
+ * own. The reader fills a ring of PIPELINE_SLOTS batches ahead of the
+ * simulation thread, which hands each batch to cache_access_batch.
+ */
+void run_pipelined(trace_reader_t *tr, cache_sim_t *sim, cache_stats_t *p_stats) {
+	std::vector<pipeline_slot_t> ring(PIPELINE_SLOTS);
+	std::mutex lock;
+	std::condition_variable filled, drained;
+	uint64_t produced = 0, consumed = 0;
+	pipeline_slot_t *slot;
+
+	std::thread reader([&]() {
+		pipeline_slot_t *next;
+
+		do {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				drained.wait(guard, [&]() { return produced - consumed < PIPELINE_SLOTS; });
+			}
+			// the simulation thread leaves this slot alone until it is published
+			next = &ring[produced % PIPELINE_SLOTS];
+			next->n = trace_read(tr, next->accesses, PIPELINE_BATCH);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				produced++;
+			}
+			filled.notify_one();
+		} while (next->n > 0);
+	});
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			filled.wait(guard, [&]() { return consumed != produced; });
+			slot = &ring[consumed % PIPELINE_SLOTS];
+		}
+		if (slot->n == 0) {
+			break;
+		}
+		sim->cache_access_batch(slot->accesses, slot->n, p_stats);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			consumed++;
+		}
+		drained.notify_one();
+	}
+	reader.join();
+}
@@ -0,0 +1,13 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+// batches in flight between the reader and the simulation thread
+#define PIPELINE_SLOTS 4
+#define PIPELINE_BATCH TRACE_BATCH
+
+void run_pipelined(trace_reader_t *tr, cache_sim_t *sim, cache_stats_t *p_stats);
+
+#endif /* PIPELINE_HPP */
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "profile.hpp"
+
+static const uint64_t profile_events[PROFILE_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+static const char *profile_names[PROFILE_COUNTERS] = {
+	"Cycles", "Instructions", "LLC misses", "Branch misses"
+};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Open the hardware counters as one group, user space only and stopped.
+ * Without all of them, perf_event_paranoid or a host without a PMU, none
+ * are kept and prof->error says why.
+ */
+void profile_open(profile_t *prof) {
+	struct perf_event_attr attr;
+	int k;
+
+	memset(prof, 0, sizeof(*prof));
+	for (k=0; k<PROFILE_COUNTERS; k++) {
+		prof->fds[k] = -1;
+	}
+	for (k=0; k<PROFILE_COUNTERS; k++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = profile_events[k];
+		attr.disabled = (k == 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+		                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		prof->fds[k] = syscall(__NR_perf_event_open, &attr, 0, -1, prof->fds[0], 0);
+		if (prof->fds[k] < 0) {
+			prof->error = errno;
+			profile_close(prof);
+			return;
+		}
+	}
+}
+
+void profile_close(profile_t *prof) {
+	int k;
+
+	for (k=0; k<PROFILE_COUNTERS; k++) {
+		if (prof->fds[k] >= 0) {
+			close(prof->fds[k]);
+			prof->fds[k] = -1;
+		}
+	}
+}
+
+/**
+ * Simulate a trace serially, timing the reads and the simulation of each
+ * batch apart, and counting only the simulation in hardware.
+ */
+void run_profiled(trace_reader_t *tr, cache_sim_t *sim, cache_stats_t *p_stats, profile_t *prof) {
+	static access_t batch[TRACE_BATCH];
+	uint64_t values[3 + PROFILE_COUNTERS];
+	double t0, t1, t2;
+	size_t n;
+	int k;
+
+	t0 = now();
+	while ((n = trace_read(tr, batch, TRACE_BATCH)) > 0) {
+		t1 = now();
+		if (prof->fds[0] >= 0) {
+			ioctl(prof->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+		sim->cache_access_batch(batch, n, p_stats);
+		if (prof->fds[0] >= 0) {
+			ioctl(prof->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		}
+		t2 = now();
+		prof->parse += t1 - t0;
+		prof->simulate += t2 - t1;
+		prof->accesses += n;
+		t0 = t2;
+	}
+	prof->parse += now() - t0;
+
+	// nr, time enabled, time running, then the counters in group order
+	if ((prof->fds[0] >= 0) && (read(prof->fds[0], values, sizeof(values)) == sizeof(values)) &&
+	    (values[1] > 0) && (values[2] > 0)) {
+		// a multiplexed group only ran part of the time, scale it up
+		prof->scale = (double) values[2] / values[1];
+		for (k=0; k<PROFILE_COUNTERS; k++) {
+			prof->counters[k] = values[3 + k] / prof->scale;
+		}
+	}
+	profile_close(prof);
+}
+
+void complete_profiled(cache_sim_t *sim, cache_stats_t *p_stats, profile_t *prof) {
+	double t0 = now();
+
+	sim->complete_cache(p_stats);
+	prof->finalize = now() - t0;
+}
+
+void print_profile(FILE *out, const profile_t *prof) {
+	double total = prof->parse + prof->simulate + prof->finalize;
+	int k;
+
+	fprintf(out, "Profile\n");
+	fprintf(out, "Parse seconds: %f (%.1f%%)\n", prof->parse,
+	        total > 0 ? 100 * prof->parse / total : 0);
+	fprintf(out, "Simulate seconds: %f (%.1f%%)\n", prof->simulate,
+	        total > 0 ? 100 * prof->simulate / total : 0);
+	fprintf(out, "Finalize seconds: %f (%.1f%%)\n", prof->finalize,
+	        total > 0 ? 100 * prof->finalize / total : 0);
+	fprintf(out, "Accesses per second: %f\n", total > 0 ? prof->accesses / total : 0);
+	fprintf(out, "Simulated accesses per second: %f\n",
+	        prof->simulate > 0 ? prof->accesses / prof->simulate : 0);
+	if (prof->scale <= 0) {
+		fprintf(out, "Hardware counters: unavailable (%s)\n",
+		        prof->error ? strerror(prof->error) : "never ran");
+		return;
+	}
+	for (k=0; k<PROFILE_COUNTERS; k++) {
+		fprintf(out, "%s: %" PRIu64 " (%f per access)\n", profile_names[k], prof->counters[k],
+		        prof->accesses ? (double) prof->counters[k] / prof->accesses : 0);
+	}
+	fprintf(out, "IPC: %f\n", prof->counters[0] ? (double) prof->counters[1] / prof->counters[0] : 0);
+	if (prof->scale < 1) {
+		fprintf(out, "Counters multiplexed, scaled from %.1f%% of the time\n", 100 * prof->scale);
+	}
+}
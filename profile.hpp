@@ -0,0 +1,27 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+// cycles, instructions, LLC misses and branch misses
+#define PROFILE_COUNTERS 4
+
+struct profile_t {
+	double   parse;       // seconds reading and parsing the trace
+	double   simulate;    // seconds in the cache
+	double   finalize;    // seconds completing the statistics
+	uint64_t accesses;
+	int      fds[PROFILE_COUNTERS];  // fds[0] leads the group, -1 if not open
+	int      error;       // errno of the perf_event_open that failed, or 0
+	uint64_t counters[PROFILE_COUNTERS];
+	double   scale;       // share of the simulation the counters ran for
+};
+
+void profile_open(profile_t *prof);
+void profile_close(profile_t *prof);
+void run_profiled(trace_reader_t *tr, cache_sim_t *sim, cache_stats_t *p_stats, profile_t *prof);
+void complete_profiled(cache_sim_t *sim, cache_stats_t *p_stats, profile_t *prof);
+void print_profile(FILE *out, const profile_t *prof);
+
+#endif /* PROFILE_HPP */
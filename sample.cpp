@@ -0,0 +1,169 @@
+#include <math.h>
+#include <vector>
+#include "sample.hpp"
+
+/**
+ * Parse "measure:warm:period" for interval sampling.
+ *
+ * @return 0 on success, -1 on error
+ */
+int parse_intervals(const char *arg, sample_config_t *cfg) {
+	unsigned long long measure, warm, period;
+
+	if ((sscanf(arg, "%llu:%llu:%llu", &measure, &warm, &period) != 3) || (measure == 0) ||
+	    (measure + warm > period)) {
+		fprintf(stderr, "%s: expected measure:warm:period with measure + warm <= period\n", arg);
+		return -1;
+	}
+	cfg->measure = measure;
+	cfg->warm = warm;
+	cfg->period = period;
+	return 0;
+}
+
+static inline uint64_t set_hash(uint64_t index) {
+	return (index * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/**
+ * Scale the counted misses of one kind up to every access of that kind.
+ */
+static inline uint64_t scale(uint64_t misses, uint64_t counted, uint64_t total) {
+	return counted ? (uint64_t) llround((double) misses * total / counted) : 0;
+}
+
+/**
+ * Simulate a sample of the trace and extrapolate the whole run from it.
+ *
+ * Set sampling simulates the sets whose hashed index falls in 1 of 2^k
+ * buckets. The victim cache is shared by every set, so it shrinks by the
+ * same factor to keep each sampled set's share of it. Interval sampling
+ * only functionally warms the start of every period, updating the main
+ * cache's tags and replacement state with no stats. It simulates the next
+ * warm accesses in full, which warms the victim cache too, and counts the
+ * last measure ones.
+ *
+ * The miss rate is a ratio estimate over clusters, the measured intervals
+ * or else random groups of sampled sets, whose spread gives the
+ * confidence interval. With fewer than two clusters there is no spread
+ * and the interval is left at -1.
+ */
+void run_sampled(trace_reader_t *tr, const sweep_config_t *geometry, const sample_config_t *cfg,
+                 sample_result_t *res) {
+	static access_t batch[TRACE_BATCH];
+	cache_sim_t *sim = new cache_sim_t();
+	cache_sim_t *full = new cache_sim_t();
+	uint64_t v = (geometry->v > cfg->set_bits) ? geometry->v - cfg->set_bits : 0;
+	uint64_t mask = (1ULL << cfg->set_bits) - 1;
+	uint64_t pos = 0, phase, skip, before, tag, index, block_offset, h, cluster;
+	uint64_t reads = 0, writes = 0;
+	std::vector<uint64_t> cluster_accesses, cluster_misses;
+	cache_stats_t measured, scratch;
+	double f, r, abar, s2, var;
+	size_t n, j, k;
+
+	sim->setup_cache(geometry->c, geometry->b, geometry->s, v, geometry->st, geometry->r);
+	full->setup_cache(geometry->c, geometry->b, geometry->s, geometry->v, geometry->st, geometry->r);
+	memset(res, 0, sizeof(*res));
+	memset(&measured, 0, sizeof(measured));
+	memset(&scratch, 0, sizeof(scratch));
+	if (!cfg->period) {
+		cluster_accesses.resize(SAMPLE_CLUSTERS);
+		cluster_misses.resize(SAMPLE_CLUSTERS);
+	}
+	skip = cfg->period - cfg->warm - cfg->measure;
+
+	while ((n = trace_read(tr, batch, TRACE_BATCH)) > 0) {
+		for (j=0; j<n; j++) {
+			const access_t *acc = &batch[j];
+
+			if (cfg->validate) {
+				full->cache_access(acc->rw, acc->address, &res->full);
+			}
+			if (acc->rw == READ) {
+				reads++;
+			} else {
+				writes++;
+			}
+			phase = cfg->period ? pos % cfg->period : skip;
+			cluster = cfg->period ? pos / cfg->period : 0;
+			pos++;
+
+			full->decode_address(acc->address, &tag, &index, &block_offset);
+			h = set_hash(index);
+			if (h & mask) {
+				continue;
+			}
+			if (phase < skip) {
+				sim->warm_access(acc->rw, acc->address);
+				res->warmed++;
+				continue;
+			}
+			res->simulated++;
+			if (phase < skip + cfg->warm) {
+				sim->cache_access(acc->rw, acc->address, &scratch);
+				continue;
+			}
+
+			before = measured.read_misses_combined + measured.write_misses_combined;
+			sim->cache_access(acc->rw, acc->address, &measured);
+			if (!cfg->period) {
+				cluster = (h >> cfg->set_bits) % SAMPLE_CLUSTERS;
+			} else if (cluster >= cluster_accesses.size()) {
+				cluster_accesses.resize(cluster + 1);
+				cluster_misses.resize(cluster + 1);
+			}
+			cluster_accesses[cluster]++;
+			cluster_misses[cluster] += measured.read_misses_combined + measured.write_misses_combined -
+			                           before;
+		}
+	}
+	res->measured = measured.accesses;
+
+	// every kind of miss scales with the accesses of its own kind
+	res->estimate.accesses = reads + writes;
+	res->estimate.reads = reads;
+	res->estimate.writes = writes;
+	res->estimate.read_misses = scale(measured.read_misses, measured.reads, reads);
+	res->estimate.read_misses_combined = scale(measured.read_misses_combined, measured.reads, reads);
+	res->estimate.write_misses = scale(measured.write_misses, measured.writes, writes);
+	res->estimate.write_misses_combined = scale(measured.write_misses_combined, measured.writes,
+	                                            writes);
+	res->estimate.writebacks = scale(measured.writebacks, measured.accesses, reads + writes);
+	res->estimate.bytes_read = scale(measured.bytes_read, measured.accesses, reads + writes);
+	res->estimate.bytes_written = scale(measured.bytes_written, measured.accesses, reads + writes);
+	// the full run flushes its dirty lines first, so none end up in the estimate
+	if (cfg->validate) {
+		full->complete_cache(&res->full);
+	}
+	full->complete_cache(&res->estimate);
+
+	// ratio estimator variance over the clusters that were sampled at all
+	f = 1.0 / (mask + 1);
+	if (cfg->period) {
+		f *= (double) cfg->measure / cfg->period;
+	}
+	res->miss_rate_ci = -1;
+	n = 0;
+	for (k=0; k<cluster_accesses.size(); k++) {
+		n += (cluster_accesses[k] > 0);
+	}
+	if ((n > 1) && measured.accesses) {
+		r = (double) (measured.read_misses_combined + measured.write_misses_combined) /
+		    measured.accesses;
+		abar = (double) measured.accesses / n;
+		s2 = 0;
+		for (k=0; k<cluster_accesses.size(); k++) {
+			if (cluster_accesses[k]) {
+				s2 += pow(cluster_misses[k] - r * cluster_accesses[k], 2);
+			}
+		}
+		s2 /= n - 1;
+		var = (1 - f) * s2 / (n * abar * abar);
+		res->miss_rate_ci = 1.96 * sqrt(var);
+	}
+	res->aat_ci = (res->miss_rate_ci < 0) ? -1 : res->miss_rate_ci * res->estimate.miss_penalty;
+
+	delete sim;
+	delete full;
+}
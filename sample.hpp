@@ -0,0 +1,33 @@
+#ifndef SAMPLE_HPP
+#define SAMPLE_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+#include "sweep.hpp"
+
+// groups the sampled sets are split into for the error estimate
+#define SAMPLE_CLUSTERS 256
+
+struct sample_config_t {
+	uint64_t set_bits;   // simulate 1 in 2^set_bits sets, 0 for all of them
+	uint64_t measure;    // interval sampling, every period accesses end with
+	uint64_t warm;       // warm accesses simulated but not counted, then
+	uint64_t period;     // measure counted ones; period 0 turns it off
+	int validate;        // simulate the whole trace too, for comparison
+};
+
+struct sample_result_t {
+	cache_stats_t estimate;  // extrapolated to the whole trace, completed
+	cache_stats_t full;      // the whole trace, with validate
+	uint64_t warmed;         // accesses the sampled cache only warmed its tags on
+	uint64_t simulated;      // accesses the sampled cache saw in full
+	uint64_t measured;       // of which counted
+	double miss_rate_ci;     // half width of the 95% confidence interval, -1 if unknown
+	double aat_ci;
+};
+
+int parse_intervals(const char *arg, sample_config_t *cfg);
+void run_sampled(trace_reader_t *tr, const sweep_config_t *geometry, const sample_config_t *cfg,
+                 sample_result_t *res);
+
+#endif /* SAMPLE_HPP */
@@ -0,0 +1,173 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "shard.hpp"
+
+struct shard_chunk_t {
+	std::vector<access_t> accesses;
+	std::vector<uint32_t> order;       // access positions grouped by shard
+	std::vector<uint32_t> start;       // shard t owns order[start[t]..start[t+1])
+	std::vector<victim_event_t> events;
+	size_t n;
+};
+
+/**
+ * Sum the counters of two partial runs. Derived fields are left to
+ * complete_cache.
+ */
+void add_stats(cache_stats_t *to, const cache_stats_t *from) {
+	to->accesses += from->accesses;
+	to->reads += from->reads;
+	to->read_misses += from->read_misses;
+	to->read_misses_combined += from->read_misses_combined;
+	to->writes += from->writes;
+	to->write_misses += from->write_misses;
+	to->write_misses_combined += from->write_misses_combined;
+	to->fast_hits += from->fast_hits;
+	to->writebacks += from->writebacks;
+	to->bytes_read += from->bytes_read;
+	to->bytes_written += from->bytes_written;
+	to->compulsory_misses += from->compulsory_misses;
+	to->capacity_misses += from->capacity_misses;
+	to->conflict_misses += from->conflict_misses;
+}
+
+static void read_chunk(trace_reader_t *tr, cache_sim_t *sim, unsigned threads,
+                       shard_chunk_t *chunk, std::vector<uint32_t> &shard_of) {
+	uint64_t tag, index, block_offset;
+	size_t j;
+	unsigned t;
+
+	chunk->n = trace_read(tr, &chunk->accesses[0], SHARD_CHUNK);
+
+	// counting sort by shard, stable so every set sees its accesses in order
+	chunk->start.assign(threads + 1, 0);
+	for (j=0; j<chunk->n; j++) {
+		sim->decode_address(chunk->accesses[j].address, &tag, &index, &block_offset);
+		shard_of[j] = index % threads;
+		chunk->start[shard_of[j] + 1]++;
+	}
+	for (t=0; t<threads; t++) {
+		chunk->start[t + 1] += chunk->start[t];
+	}
+	std::vector<uint32_t> next(chunk->start.begin(), chunk->start.end() - 1);
+	for (j=0; j<chunk->n; j++) {
+		chunk->order[next[shard_of[j]]++] = j;
+	}
+}
+
+/**
+ * Simulate one configuration with its sets split across threads. Set i is
+ * simulated by worker i % threads, which records each main cache miss in
+ * the chunk's event slot. The main thread then replays the misses through
+ * the shared victim cache in trace order while the workers move on to the
+ * next chunk, and decodes the chunk after that. Every set and the victim
+ * cache see their accesses in trace order, so every replacement decision
+ * matches the serial run.
+ *
+ * Only valid for configurations where sim->shardable() holds.
+ */
+void run_sharded(trace_reader_t *tr, cache_sim_t *sim, unsigned threads, cache_stats_t *p_stats) {
+	shard_chunk_t chunks[2];
+	std::vector<cache_stats_t> shard_stats(threads);
+	std::vector<uint32_t> shard_of(SHARD_CHUNK);
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable start, finished;
+	uint64_t generation = 0;
+	unsigned done = 0, t;
+	int cur = 0, stop = 0, have_prev = 0;
+	size_t j;
+
+	memset(&shard_stats[0], 0, sizeof(cache_stats_t) * threads);
+	for (j=0; j<2; j++) {
+		chunks[j].accesses.resize(SHARD_CHUNK);
+		chunks[j].order.resize(SHARD_CHUNK);
+		chunks[j].events.resize(SHARD_CHUNK);
+	}
+
+	for (t=0; t<threads; t++) {
+		workers.push_back(std::thread([&, t]() {
+			uint64_t seen = 0, tag, index, block_offset;
+			shard_chunk_t *chunk;
+
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					start.wait(guard, [&]() { return stop || (generation != seen); });
+					if (stop) {
+						return;
+					}
+					seen = generation;
+					chunk = &chunks[cur];
+				}
+				for (uint32_t pos=chunk->start[t]; pos<chunk->start[t + 1]; pos++) {
+					uint32_t a = chunk->order[pos];
+					access_t *acc = &chunk->accesses[a];
+					victim_event_t *ev = &chunk->events[a];
+
+					sim->decode_address(acc->address, &tag, &index, &block_offset);
+					if (sim->main_lookup(acc->rw, acc->address, &shard_stats[t], tag, index,
+					                     block_offset, ev)) {
+						ev->rw = 0;
+						continue;
+					}
+					ev->rw = acc->rw;
+					ev->address = acc->address;
+					ev->way = NO_WAY;
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				if (++done == threads) {
+					finished.notify_one();
+				}
+			}
+		}));
+	}
+
+	read_chunk(tr, sim, threads, &chunks[cur], shard_of);
+	while (chunks[cur].n > 0) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done = 0;
+			generation++;
+		}
+		start.notify_all();
+
+		// the victim cache replays the previous chunk in trace order
+		if (have_prev) {
+			shard_chunk_t *prev = &chunks[cur ^ 1];
+			for (j=0; j<prev->n; j++) {
+				if (prev->events[j].rw) {
+					sim->victim_lookup(&prev->events[j], p_stats);
+				}
+			}
+		}
+		read_chunk(tr, sim, threads, &chunks[cur ^ 1], shard_of);
+
+		std::unique_lock<std::mutex> guard(lock);
+		finished.wait(guard, [&]() { return done == threads; });
+		have_prev = 1;
+		cur ^= 1;
+	}
+
+	// chunks[cur] is the empty end of the trace, the other one is pending
+	if (have_prev) {
+		shard_chunk_t *prev = &chunks[cur ^ 1];
+		for (j=0; j<prev->n; j++) {
+			if (prev->events[j].rw) {
+				sim->victim_lookup(&prev->events[j], p_stats);
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = 1;
+	}
+	start.notify_all();
+	for (t=0; t<threads; t++) {
+		workers[t].join();
+		add_stats(p_stats, &shard_stats[t]);
+	}
+}
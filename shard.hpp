@@ -0,0 +1,13 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+// accesses decoded and partitioned per round of the sharded simulation
+#define SHARD_CHUNK (1 << 16)
+
+void add_stats(cache_stats_t *to, const cache_stats_t *from);
+void run_sharded(trace_reader_t *tr, cache_sim_t *sim, unsigned threads, cache_stats_t *p_stats);
+
+#endif /* SHARD_HPP */
@@ -0,0 +1,178 @@
+#include "stackdist.hpp"
+#include "sweep.hpp"
+
+#define SD_NONE UINT32_MAX
+#define SD_MIN_TREE 16
+
+static inline void tree_add(std::vector<uint32_t> &tree, uint32_t t, int32_t delta) {
+	uint32_t size = tree.size() - 1;
+
+	for (; t <= size; t += t & -t) {
+		tree[t] += delta;
+	}
+}
+
+static inline uint32_t tree_sum(const std::vector<uint32_t> &tree, uint32_t t) {
+	uint32_t sum = 0;
+
+	for (; t > 0; t -= t & -t) {
+		sum += tree[t];
+	}
+	return sum;
+}
+
+/**
+ * Set up the engine for blocks of 2^b bytes and caches of up to 2^c bytes.
+ */
+void stack_dist_t::setup(uint64_t c, uint64_t b) {
+	uint64_t k;
+
+	this->c = c;
+	this->b = b;
+	index_bits = c - b;
+	reads = 0;
+	writes = 0;
+	block_ids.clear();
+	last.clear();
+
+	levels.clear();
+	levels.resize(index_bits + 1);
+	for (k=0; k<=index_bits; k++) {
+		levels[k].sets.resize(1ULL << k);
+		memset(levels[k].hist, 0, sizeof(levels[k].hist));
+	}
+}
+
+/**
+ * Renumber the live marks of a full set to 1..live and size its tree so at
+ * least as many free slots follow. Keeps the tree proportional to the
+ * number of distinct blocks in the set, not to the trace length.
+ */
+void stack_dist_t::compact(uint64_t k, sd_set_t *set) {
+	uint32_t t, next = 0, size, j;
+
+	for (t=1; t<=set->clock; t++) {
+		if (set->owner[t] != SD_NONE) {
+			next++;
+			set->owner[next] = set->owner[t];
+			last[set->owner[next] * (index_bits + 1) + k] = next;
+		}
+	}
+
+	size = SD_MIN_TREE;
+	while (size < 2 * next) {
+		size *= 2;
+	}
+	set->owner.resize(size + 1);
+	set->tree.assign(size + 1, 0);
+	for (t=next+1; t<=size; t++) {
+		set->owner[t] = SD_NONE;
+	}
+	// linear time fenwick build from the marks at 1..next
+	for (t=1; t<=size; t++) {
+		set->tree[t] += (t <= next);
+		j = t + (t & -t);
+		if (j <= size) {
+			set->tree[j] += set->tree[t];
+		}
+	}
+	set->clock = next;
+	set->live = next;
+}
+
+void stack_dist_t::access(char rw, uint64_t address) {
+	uint64_t block = address >> b;
+	uint32_t id, prev, dist, *block_last;
+	uint64_t k;
+	int bits;
+	std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> ins;
+
+	if (rw == READ) {
+		reads++;
+	} else {
+		writes++;
+	}
+
+	ins = block_ids.insert(std::make_pair(block, (uint32_t) block_ids.size()));
+	id = ins.first->second;
+	if (ins.second) {
+		last.resize(last.size() + index_bits + 1, 0);
+	}
+	block_last = &last[id * (index_bits + 1)];
+
+	for (k=0; k<=index_bits; k++) {
+		sd_level_t *level = &levels[k];
+		sd_set_t *set = &level->sets[block & ((1ULL << k) - 1)];
+
+		prev = block_last[k];
+		if (prev) {
+			// distinct blocks of this set touched since the last access
+			dist = set->live - tree_sum(set->tree, prev);
+			bits = dist ? 32 - __builtin_clz(dist) : 0;
+			tree_add(set->tree, prev, -1);
+			set->owner[prev] = SD_NONE;
+			set->live--;
+		} else {
+			bits = SD_COLD;
+		}
+		level->hist[rw != READ][bits]++;
+
+		if (set->clock + 1 >= set->tree.size()) {
+			compact(k, set);
+		}
+		set->clock++;
+		set->live++;
+		set->owner[set->clock] = id;
+		tree_add(set->tree, set->clock, 1);
+		block_last[k] = set->clock;
+	}
+}
+
+/**
+ * Print the main cache misses of every geometry up to 2^c bytes, one row
+ * per (sets, ways) point with the matching -c/-b/-s arguments.
+ */
+void stack_dist_t::print(FILE *out, char format) {
+	uint64_t k, w, read_hits, write_hits, read_misses, write_misses;
+	double miss_rate;
+	int first = 1;
+
+	if (format == FORMAT_CSV) {
+		fprintf(out, "C,B,S,sets,ways,accesses,reads,read_misses,writes,write_misses,miss_rate\n");
+	} else {
+		fprintf(out, "[\n");
+	}
+
+	for (k=0; k<=index_bits; k++) {
+		read_hits = 0;
+		write_hits = 0;
+		for (w=0; w<=index_bits-k; w++) {
+			// a distance of bit length w still hits with 2^w ways
+			read_hits += levels[k].hist[0][w];
+			write_hits += levels[k].hist[1][w];
+			read_misses = reads - read_hits;
+			write_misses = writes - write_hits;
+			miss_rate = (double) (read_misses + write_misses) / (reads + writes);
+
+			if (format == FORMAT_CSV) {
+				fprintf(out, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+				        "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f\n",
+				        b + k + w, b, w, (uint64_t) 1 << k, (uint64_t) 1 << w, reads + writes,
+				        reads, read_misses, writes, write_misses, miss_rate);
+			} else {
+				fprintf(out, "%s  {\"C\": %" PRIu64 ", \"B\": %" PRIu64 ", \"S\": %" PRIu64 ", "
+				        "\"sets\": %" PRIu64 ", \"ways\": %" PRIu64 ", \"accesses\": %" PRIu64 ", "
+				        "\"reads\": %" PRIu64 ", \"read_misses\": %" PRIu64 ", "
+				        "\"writes\": %" PRIu64 ", \"write_misses\": %" PRIu64 ", "
+				        "\"miss_rate\": %f}",
+				        first ? "" : ",\n", b + k + w, b, w, (uint64_t) 1 << k, (uint64_t) 1 << w,
+				        reads + writes, reads, read_misses, writes, write_misses, miss_rate);
+				first = 0;
+			}
+		}
+	}
+
+	if (format == FORMAT_JSON) {
+		fprintf(out, "\n]\n");
+	}
+}
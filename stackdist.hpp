@@ -0,0 +1,51 @@
+#ifndef STACKDIST_HPP
+#define STACKDIST_HPP
+
+#include <unordered_map>
+#include <vector>
+#include "cachesim.hpp"
+
+// histogram bucket for first touches, distances use buckets 0..ADDRESS_SIZE
+#define SD_COLD (ADDRESS_SIZE + 1)
+
+struct sd_set_t {
+	uint32_t clock;               // local time of the newest access to the set
+	uint32_t live;                // blocks with a mark in the tree
+	std::vector<uint32_t> tree;   // fenwick tree over local time, 1-based
+	std::vector<uint32_t> owner;  // block id marked at each local time
+};
+
+struct sd_level_t {
+	std::vector<sd_set_t> sets;
+	uint64_t hist[2][SD_COLD + 1];  // [is write][bit length of the stack distance]
+};
+
+/**
+ * Mattson stack-distance engine. One pass over the trace yields the LRU
+ * main cache misses of every 2^k sets x 2^w ways geometry with blocks of
+ * 2^b bytes and k + w <= c - b. Those are exactly the read_misses and
+ * write_misses cache_access reports for an LRU, BLOCKING configuration;
+ * the victim cache never changes which blocks the main cache holds.
+ */
+class stack_dist_t {
+public:
+	void setup(uint64_t c, uint64_t b);
+	void access(char rw, uint64_t address);
+	void print(FILE *out, char format);
+
+private:
+	void compact(uint64_t k, sd_set_t *set);
+
+	uint64_t c;
+	uint64_t b;
+	uint64_t index_bits;
+	uint64_t reads;
+	uint64_t writes;
+	std::unordered_map<uint64_t, uint32_t> block_ids;
+	// local time of each block's last access per level, index_bits + 1
+	// entries per block id so one access touches one cache line; 0 = never
+	std::vector<uint32_t> last;
+	std::vector<sd_level_t> levels;
+};
+
+#endif /* STACKDIST_HPP */
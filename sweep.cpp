@@ -0,0 +1,216 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sweep.hpp"
+
+/**
+ * Read sweep points, one "C B S V ST R" line per configuration, e.g.
+ * "15 5 3 2 B L". Blank lines and lines starting with '#' are skipped.
+ *
+ * @return 0 on success, -1 on error
+ */
+int read_sweep_configs(const char *path, sweep_config_t **configs, size_t *count) {
+	FILE *fin;
+	char line[256], st[4], r[4];
+	unsigned long long c, b, s, v;
+	uint64_t lineno = 0;
+	size_t n = 0, size = 16;
+	sweep_config_t *cfg;
+	int ret;
+
+	fin = fopen(path, "r");
+	if (!fin) {
+		perror(path);
+		return -1;
+	}
+
+	cfg = (sweep_config_t *) malloc(sizeof(sweep_config_t) * size);
+	while (fgets(line, sizeof(line), fin)) {
+		lineno++;
+		ret = sscanf(line, " %c", st);
+		if ((ret != 1) || (st[0] == '#')) {
+			continue;
+		}
+		ret = sscanf(line, "%llu %llu %llu %llu %3s %3s", &c, &b, &s, &v, st, r);
+		if ((ret != 6) || ((b + s) > c) || (c >= ADDRESS_SIZE) ||
+		    ((st[0] != BLOCKING) && (st[0] != SUBBLOCKING)) ||
+		    !replacement_name(r[0])) {
+			fprintf(stderr, "%s:%" PRIu64 ": bad sweep configuration\n", path, lineno);
+			free(cfg);
+			fclose(fin);
+			return -1;
+		}
+		if (n == size) {
+			size *= 2;
+			cfg = (sweep_config_t *) realloc(cfg, sizeof(sweep_config_t) * size);
+		}
+		cfg[n].c = c;
+		cfg[n].b = b;
+		cfg[n].s = s;
+		cfg[n].v = v;
+		cfg[n].st = st[0];
+		cfg[n].r = r[0];
+		n++;
+	}
+	fclose(fin);
+
+	*configs = cfg;
+	*count = n;
+	return 0;
+}
+
+/**
+ * Simulate every configuration over one pass of the trace. Each chunk is
+ * decoded once; with one thread the instances take turns on it, otherwise
+ * instance i belongs to worker i % threads and the next chunk is decoded
+ * while the workers run.
+ *
+ * @stats One zeroed cache_stats_t per configuration, completed on return
+ */
+void run_sweep(trace_reader_t *tr, const sweep_config_t *configs, size_t count,
+               unsigned threads, cache_stats_t *stats) {
+	std::vector<cache_sim_t *> sims(count);
+	std::vector<access_t> chunk[2];
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable start, finished;
+	uint64_t generation = 0;
+	unsigned done = 0;
+	size_t n[2], i;
+	int cur = 0, stop = 0;
+
+	for (i=0; i<count; i++) {
+		sims[i] = new cache_sim_t();
+		sims[i]->setup_cache(configs[i].c, configs[i].b, configs[i].s, configs[i].v,
+		                     configs[i].st, configs[i].r);
+	}
+	chunk[0].resize(SWEEP_CHUNK);
+	chunk[1].resize(SWEEP_CHUNK);
+
+	if (threads > count) {
+		threads = count;
+	}
+
+	n[cur] = trace_read(tr, &chunk[cur][0], SWEEP_CHUNK);
+
+	if (threads <= 1) {
+		while (n[cur] > 0) {
+			for (i=0; i<count; i++) {
+				sims[i]->cache_access_batch(&chunk[cur][0], n[cur], &stats[i]);
+			}
+			n[cur] = trace_read(tr, &chunk[cur][0], SWEEP_CHUNK);
+		}
+	} else {
+		for (unsigned t=0; t<threads; t++) {
+			workers.push_back(std::thread([&, t]() {
+				uint64_t seen = 0;
+				int mine;
+
+				for (;;) {
+					{
+						std::unique_lock<std::mutex> guard(lock);
+						start.wait(guard, [&]() { return stop || (generation != seen); });
+						if (stop) {
+							return;
+						}
+						seen = generation;
+						mine = cur;
+					}
+					for (size_t k=t; k<count; k+=threads) {
+						sims[k]->cache_access_batch(&chunk[mine][0], n[mine], &stats[k]);
+					}
+					std::lock_guard<std::mutex> guard(lock);
+					if (++done == threads) {
+						finished.notify_one();
+					}
+				}
+			}));
+		}
+
+		while (n[cur] > 0) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				done = 0;
+				generation++;
+			}
+			start.notify_all();
+
+			// decode the next chunk while the workers simulate this one
+			n[cur ^ 1] = trace_read(tr, &chunk[cur ^ 1][0], SWEEP_CHUNK);
+
+			std::unique_lock<std::mutex> guard(lock);
+			finished.wait(guard, [&]() { return done == threads; });
+			cur ^= 1;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = 1;
+		}
+		start.notify_all();
+		for (i=0; i<workers.size(); i++) {
+			workers[i].join();
+		}
+	}
+
+	for (i=0; i<count; i++) {
+		sims[i]->complete_cache(&stats[i]);
+		delete sims[i];
+	}
+}
+
+/**
+ * Print one row per configuration with the fields of print_statistics.
+ */
+void print_sweep(FILE *out, char format, const sweep_config_t *configs,
+                 const cache_stats_t *stats, size_t count) {
+	size_t i;
+
+	if (format == FORMAT_CSV) {
+		fprintf(out, "C,B,S,V,ST,R,accesses,reads,read_misses,read_misses_combined,"
+		             "writes,write_misses,write_misses_combined,misses,hit_time,"
+		             "miss_penalty,miss_rate,avg_access_time,storage_overhead,"
+		             "storage_overhead_ratio\n");
+	} else {
+		fprintf(out, "[\n");
+	}
+
+	for (i=0; i<count; i++) {
+		const sweep_config_t *cfg = &configs[i];
+		const cache_stats_t *p_stats = &stats[i];
+
+		if (format == FORMAT_CSV) {
+			fprintf(out, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%c,%c,"
+			        "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ","
+			        "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%f,%" PRIu64 ",%f\n",
+			        cfg->c, cfg->b, cfg->s, cfg->v, cfg->st, cfg->r,
+			        p_stats->accesses, p_stats->reads, p_stats->read_misses,
+			        p_stats->read_misses_combined, p_stats->writes, p_stats->write_misses,
+			        p_stats->write_misses_combined, p_stats->misses, p_stats->hit_time,
+			        p_stats->miss_penalty, p_stats->miss_rate, p_stats->avg_access_time,
+			        p_stats->storage_overhead, p_stats->storage_overhead_ratio);
+		} else {
+			fprintf(out, "  {\"C\": %" PRIu64 ", \"B\": %" PRIu64 ", \"S\": %" PRIu64 ", "
+			        "\"V\": %" PRIu64 ", \"ST\": \"%c\", \"R\": \"%c\", "
+			        "\"accesses\": %" PRIu64 ", \"reads\": %" PRIu64 ", "
+			        "\"read_misses\": %" PRIu64 ", \"read_misses_combined\": %" PRIu64 ", "
+			        "\"writes\": %" PRIu64 ", \"write_misses\": %" PRIu64 ", "
+			        "\"write_misses_combined\": %" PRIu64 ", \"misses\": %" PRIu64 ", "
+			        "\"hit_time\": %" PRIu64 ", \"miss_penalty\": %" PRIu64 ", "
+			        "\"miss_rate\": %f, \"avg_access_time\": %f, "
+			        "\"storage_overhead\": %" PRIu64 ", \"storage_overhead_ratio\": %f}%s\n",
+			        cfg->c, cfg->b, cfg->s, cfg->v, cfg->st, cfg->r,
+			        p_stats->accesses, p_stats->reads, p_stats->read_misses,
+			        p_stats->read_misses_combined, p_stats->writes, p_stats->write_misses,
+			        p_stats->write_misses_combined, p_stats->misses, p_stats->hit_time,
+			        p_stats->miss_penalty, p_stats->miss_rate, p_stats->avg_access_time,
+			        p_stats->storage_overhead, p_stats->storage_overhead_ratio,
+			        (i + 1 < count) ? "," : "");
+		}
+	}
+
+	if (format == FORMAT_JSON) {
+		fprintf(out, "]\n");
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+// accesses decoded per chunk and fed to every instance of a sweep
+#define SWEEP_CHUNK (1 << 16)
+
+static const char     FORMAT_CSV = 'c';
+static const char     FORMAT_JSON = 'j';
+
+struct sweep_config_t {
+	uint64_t c;
+	uint64_t b;
+	uint64_t s;
+	uint64_t v;
+	char     st;
+	char     r;
+};
+
+int read_sweep_configs(const char *path, sweep_config_t **configs, size_t *count);
+void run_sweep(trace_reader_t *tr, const sweep_config_t *configs, size_t count,
+               unsigned threads, cache_stats_t *stats);
+void print_sweep(FILE *out, char format, const sweep_config_t *configs,
+                 const cache_stats_t *stats, size_t count);
+
+#endif /* SWEEP_HPP */
@@ -0,0 +1,202 @@
+#include <functional>
+#include <queue>
+#include <vector>
+#include "timing.hpp"
+
+struct mshr_t {
+	uint64_t block;
+	uint64_t done;   // cycle the fill arrives
+};
+
+struct timing_state_t {
+	std::vector<mshr_t> mshrs;  // the busy ones
+	// completion cycles of the requests memory holds, earliest on top
+	std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t> > memory;
+	uint64_t clock;     // the occupancy histogram is complete up to here
+	uint64_t bus_free;  // cycle the memory bus is free from
+};
+
+/**
+ * Parse MSHRS[:QUEUE[:INTERVAL]], the others keeping their defaults.
+ *
+ * @return 0 on success, -1 on error
+ */
+int parse_timing(const char *arg, timing_config_t *cfg) {
+	unsigned long long mshrs, queue = DEFAULT_MEMORY_QUEUE, interval = DEFAULT_ISSUE_INTERVAL;
+
+	if ((sscanf(arg, "%llu:%llu:%llu", &mshrs, &queue, &interval) < 1) || (mshrs == 0) ||
+	    (mshrs > TIMING_MAX_MSHRS) || (queue == 0)) {
+		fprintf(stderr, "%s: expected mshrs[:queue[:interval]] with 1 <= mshrs <= %d and "
+		        "queue >= 1\n", arg, TIMING_MAX_MSHRS);
+		return -1;
+	}
+	cfg->mshrs = mshrs;
+	cfg->queue = queue;
+	cfg->interval = interval;
+	return 0;
+}
+
+/**
+ * Retire every MSHR and memory request done by cycle to, in order, and
+ * count the cycles up to it at each MSHR occupancy.
+ */
+static void advance(timing_state_t *ts, uint64_t to, timing_stats_t *out) {
+	size_t k, first;
+
+	for (;;) {
+		first = ts->mshrs.size();
+		for (k=0; k<ts->mshrs.size(); k++) {
+			if ((ts->mshrs[k].done <= to) &&
+			    ((first == ts->mshrs.size()) || (ts->mshrs[k].done < ts->mshrs[first].done))) {
+				first = k;
+			}
+		}
+		if (first == ts->mshrs.size()) {
+			break;
+		}
+		if (ts->mshrs[first].done > ts->clock) {
+			out->occupancy[ts->mshrs.size()] += ts->mshrs[first].done - ts->clock;
+			ts->clock = ts->mshrs[first].done;
+		}
+		ts->mshrs[first] = ts->mshrs.back();
+		ts->mshrs.pop_back();
+	}
+	if (to > ts->clock) {
+		out->occupancy[ts->mshrs.size()] += to - ts->clock;
+		ts->clock = to;
+	}
+	while (!ts->memory.empty() && (ts->memory.top() <= to)) {
+		ts->memory.pop();
+	}
+}
+
+/**
+ * Wait for a free memory queue entry, then put bytes on the bus no earlier
+ * than cycle ready.
+ *
+ * @now The issue cycle, moved on by the wait
+ * @return The cycle the transfer completes
+ */
+static uint64_t memory_request(timing_state_t *ts, const timing_config_t *cfg, uint64_t *now,
+                               uint64_t ready, uint64_t bytes, timing_stats_t *out) {
+	uint64_t done, from = *now;
+
+	if (ts->memory.size() >= cfg->queue) {
+		out->queue_stalls++;
+		while (ts->memory.size() >= cfg->queue) {
+			*now = ts->memory.top();
+			advance(ts, *now, out);
+		}
+		out->stall_cycles += *now - from;
+		ready += *now - from;
+	}
+	done = ((ready > ts->bus_free) ? ready : ts->bus_free) + ceil(bytes * CYCLES_PER_BYTE);
+	ts->bus_free = done;
+	ts->memory.push(done);
+	return done;
+}
+
+/**
+ * Simulate a trace on sim and time it as a non-blocking cache in front of
+ * an in-order core issuing an access every cfg->interval cycles. A miss
+ * takes an MSHR for its block, and later accesses to the block merge into
+ * it and wait for the same fill. A miss only stalls the core when every
+ * MSHR is busy or the memory queue is full. Memory takes 50 cycles plus
+ * the tag check before the data starts to move, then CYCLES_PER_BYTE per
+ * byte on a bus shared with writebacks, so a lone miss costs the
+ * miss_penalty of complete_cache.
+ *
+ * Time only moves from one access or fill to the next, never a cycle at
+ * a time.
+ */
+void run_timed(trace_reader_t *tr, cache_sim_t *sim, const timing_config_t *cfg,
+               cache_stats_t *p_stats, timing_stats_t *out) {
+	static access_t batch[TRACE_BATCH];
+	uint64_t hit_time = sim->hit_time(), penalty = sim->miss_penalty();
+	uint64_t now = 0, arrival, done, from, misses, read, written, fetch, block, block_bits;
+	uint64_t latency = 0, busy = 0, weighted = 0, k;
+	timing_state_t ts;
+	size_t i, j, n;
+
+	memset(out, 0, sizeof(*out));
+	ts.clock = 0;
+	ts.bus_free = 0;
+	block_bits = 0;
+	while (((uint64_t) 1 << block_bits) < sim->line_size()) {
+		block_bits++;
+	}
+
+	while ((n = trace_read(tr, batch, TRACE_BATCH)) > 0) {
+		for (i=0; i<n; i++) {
+			arrival = now;
+			advance(&ts, now, out);
+
+			misses = p_stats->read_misses_combined + p_stats->write_misses_combined;
+			read = p_stats->bytes_read;
+			written = p_stats->bytes_written;
+			sim->cache_access(batch[i].rw, batch[i].address, p_stats);
+			misses = p_stats->read_misses_combined + p_stats->write_misses_combined - misses;
+			read = p_stats->bytes_read - read;
+			written = p_stats->bytes_written - written;
+			block = batch[i].address >> block_bits;
+
+			for (j=0; (j<ts.mshrs.size()) && (ts.mshrs[j].block != block); j++) {
+			}
+			if (j < ts.mshrs.size()) {
+				// the block is on its way, whatever the cache says
+				out->secondary_misses++;
+				done = ts.mshrs[j].done;
+				if (done < now + hit_time) {
+					done = now + hit_time;
+				}
+			} else if (misses && read) {
+				if (ts.mshrs.size() >= cfg->mshrs) {
+					out->mshr_stalls++;
+					from = now;
+					while (ts.mshrs.size() >= cfg->mshrs) {
+						now = ts.mshrs[0].done;
+						for (j=1; j<ts.mshrs.size(); j++) {
+							if (ts.mshrs[j].done < now) {
+								now = ts.mshrs[j].done;
+							}
+						}
+						advance(&ts, now, out);
+					}
+					out->stall_cycles += now - from;
+				}
+				// a prefetch the miss set off moves on the bus as well
+				fetch = (read < sim->line_size()) ? read : sim->line_size();
+				done = memory_request(&ts, cfg, &now, now + hit_time + penalty -
+				                      (uint64_t) ceil(fetch * CYCLES_PER_BYTE), fetch, out);
+				if (read > fetch) {
+					memory_request(&ts, cfg, &now, now, read - fetch, out);
+				}
+				ts.mshrs.push_back({ block, done });
+				out->primary_misses++;
+			} else {
+				done = now + hit_time;
+				if (read) {
+					memory_request(&ts, cfg, &now, now, read, out);
+				}
+			}
+			if (written) {
+				// writebacks and write-through stores only hold the bus
+				memory_request(&ts, cfg, &now, now, written, out);
+			}
+
+			latency += done - arrival;
+			if (done > out->cycles) {
+				out->cycles = done;
+			}
+			now += cfg->interval;
+		}
+	}
+	advance(&ts, out->cycles, out);
+
+	out->effective_aat = p_stats->accesses ? (double) latency / p_stats->accesses : 0;
+	for (k=1; k<=cfg->mshrs; k++) {
+		busy += out->occupancy[k];
+		weighted += k * out->occupancy[k];
+	}
+	out->mlp = busy ? (double) weighted / busy : 0;
+}
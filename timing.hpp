@@ -0,0 +1,35 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include "cachesim.hpp"
+#include "trace.hpp"
+
+#define TIMING_MAX_MSHRS 64
+#define DEFAULT_MSHRS 8
+#define DEFAULT_MEMORY_QUEUE 16
+// cycles between two accesses the core issues
+#define DEFAULT_ISSUE_INTERVAL 1
+
+struct timing_config_t {
+	uint64_t mshrs;      // misses in flight to different blocks
+	uint64_t queue;      // fills and writebacks memory holds at once
+	uint64_t interval;   // issue rate, one access every interval cycles
+};
+
+struct timing_stats_t {
+	uint64_t cycles;            // until the last access completed
+	uint64_t stall_cycles;      // issue held up by a full MSHR file or memory queue
+	uint64_t primary_misses;    // allocated an MSHR
+	uint64_t secondary_misses;  // accesses to a block already in flight, merged
+	uint64_t mshr_stalls;       // accesses that waited for an MSHR
+	uint64_t queue_stalls;      // accesses that waited for the memory queue
+	double   effective_aat;     // issue to data, stalls included, per access
+	double   mlp;               // MSHRs busy on average while any is
+	uint64_t occupancy[TIMING_MAX_MSHRS + 1];  // cycles with k MSHRs busy
+};
+
+int parse_timing(const char *arg, timing_config_t *cfg);
+void run_timed(trace_reader_t *tr, cache_sim_t *sim, const timing_config_t *cfg,
+               cache_stats_t *p_stats, timing_stats_t *out);
+
+#endif /* TIMING_HPP */
@@ -0,0 +1,455 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.hpp"
+
+#define HEX_INVALID 0xff
+
+// hex digit value for every byte, HEX_INVALID for anything else
+static uint8_t hex_table[256];
+static int hex_table_ready;
+
+static void init_hex_table() {
+	int i;
+
+	memset(hex_table, HEX_INVALID, sizeof(hex_table));
+	for (i=0; i<10; i++) {
+		hex_table['0' + i] = i;
+	}
+	for (i=0; i<6; i++) {
+		hex_table['a' + i] = 10 + i;
+		hex_table['A' + i] = 10 + i;
+	}
+}
+
+static inline int is_space(char ch) {
+	return (ch == ' ') || (ch == '\t') || (ch == '\r');
+}
+
+/**
+ * Decode one "r|w <hex>" line in [p, eol).
+ *
+ * @return 1 if a record was decoded, 0 for a blank line, -1 if malformed
+ */
+static int parse_line(const char *p, const char *eol, access_t *out) {
+	uint64_t address = 0;
+	uint8_t digit;
+	const char *digits;
+
+	while ((p < eol) && is_space(*p)) {
+		p++;
+	}
+	if (p == eol) {
+		return 0;
+	}
+
+	out->rw = *p++;
+	if ((out->rw != READ) && (out->rw != WRITE)) {
+		return -1;
+	}
+	if ((p == eol) || !is_space(*p)) {
+		return -1;
+	}
+	while ((p < eol) && is_space(*p)) {
+		p++;
+	}
+	if (((eol - p) > 2) && (p[0] == '0') && ((p[1] | 0x20) == 'x')) {
+		p += 2;
+	}
+
+	// no per-character classification, the table lookup terminates the loop
+	digits = p;
+	while ((p < eol) && ((digit = hex_table[(uint8_t) *p]) != HEX_INVALID)) {
+		address = (address << 4) | digit;
+		p++;
+	}
+	if ((p == digits) || ((p - digits) > 16)) {
+		return -1;
+	}
+
+	while ((p < eol) && is_space(*p)) {
+		p++;
+	}
+	if (p != eol) {
+		return -1;
+	}
+
+	out->address = address;
+	return 1;
+}
+
+static void report_malformed(trace_reader_t *tr, const char *p, const char *eol) {
+	tr->malformed++;
+	if (tr->malformed <= TRACE_MAX_REPORTS) {
+		fprintf(stderr, "%s:%" PRIu64 ": malformed trace line \"%.*s\"\n",
+		        tr->name, tr->line, (int) (eol - p), p);
+	}
+}
+
+/**
+ * Move the unparsed tail to the front of the buffer and top it up from fd.
+ * Sets tr->eof once read() returns 0 or fails.
+ */
+static void refill(trace_reader_t *tr) {
+	size_t left = tr->end - tr->pos;
+	ssize_t ret;
+
+	memmove(tr->buf, tr->pos, left);
+	do {
+		ret = read(tr->fd, tr->buf + left, tr->buf_size - left);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret < 0) {
+		perror(tr->name);
+		tr->eof = 1;
+	} else if (ret == 0) {
+		tr->eof = 1;
+	} else {
+		left += ret;
+		tr->bytes += ret;
+	}
+	tr->pos = tr->buf;
+	tr->end = tr->buf + left;
+}
+
+/**
+ * Check for the binary trace header at tr->pos and consume it.
+ *
+ * @return 1 if the trace is binary, 0 if it is text, -1 on a bad header
+ */
+static int read_header(trace_reader_t *tr) {
+	const uint8_t *h = (const uint8_t *) tr->pos;
+	uint16_t version;
+
+	if (((size_t) (tr->end - tr->pos) < 4) || memcmp(h, TRACE_MAGIC, 4)) {
+		return 0;
+	}
+	if ((size_t) (tr->end - tr->pos) < sizeof(trace_header_t)) {
+		fprintf(stderr, "%s: truncated trace header\n", tr->name);
+		return -1;
+	}
+	version = h[4] | (h[5] << 8);
+	if (version != TRACE_VERSION) {
+		fprintf(stderr, "%s: unsupported trace version %u\n", tr->name, version);
+		return -1;
+	}
+	tr->block_bits = h[6];
+	tr->pos += sizeof(trace_header_t);
+	return 1;
+}
+
+/**
+ * Open a trace, detecting the text or binary format. Regular text files
+ * are mmapped, everything else (binary traces, pipes, terminals) is read
+ * through a fixed size buffer.
+ *
+ * @path The trace file, or NULL for stdin
+ * @return 0 on success, -1 on error
+ */
+int trace_open(trace_reader_t *tr, const char *path) {
+	struct stat st;
+	char magic[4];
+	void *map;
+	int ret;
+
+	if (!hex_table_ready) {
+		init_hex_table();
+		hex_table_ready = 1;
+	}
+
+	memset(tr, 0, sizeof(*tr));
+	if (path) {
+		tr->name = path;
+		tr->fd = open(path, O_RDONLY);
+		if (tr->fd < 0) {
+			perror(path);
+			return -1;
+		}
+		tr->own_fd = 1;
+	} else {
+		tr->name = "<stdin>";
+		tr->fd = STDIN_FILENO;
+	}
+
+	if ((fstat(tr->fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0) &&
+	    ((pread(tr->fd, magic, 4, 0) != 4) || memcmp(magic, TRACE_MAGIC, 4))) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, tr->fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			tr->map = (char *) map;
+			tr->map_len = st.st_size;
+			tr->pos = tr->map;
+			tr->end = tr->map + tr->map_len;
+			tr->bytes = tr->map_len;
+			tr->eof = 1;
+			return 0;
+		}
+	}
+
+	tr->buf_size = TRACE_BUFFER_SIZE;
+	tr->buf = (char *) malloc(tr->buf_size);
+	tr->pos = tr->buf;
+	tr->end = tr->buf;
+	while (!tr->eof && ((size_t) (tr->end - tr->pos) < sizeof(trace_header_t))) {
+		refill(tr);
+	}
+
+	ret = read_header(tr);
+	if (ret < 0) {
+		trace_close(tr);
+		return -1;
+	}
+	tr->binary = ret;
+	return 0;
+}
+
+static inline int get_varint(const char **pp, const char *end, uint64_t *value) {
+	const uint8_t *p = (const uint8_t *) *pp;
+	uint64_t v = 0;
+	int shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (p == (const uint8_t *) end) {
+			return -1;
+		}
+		v |= (uint64_t) (*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pp = (const char *) p;
+			*value = v;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static size_t read_binary(trace_reader_t *tr, access_t *batch, size_t max) {
+	size_t n = 0;
+	uint64_t token, delta;
+
+	while (n < max) {
+		if (tr->run_left) {
+			batch[n].rw = tr->prev_rw;
+			batch[n].address = tr->prev_address;
+			n++;
+			tr->run_left--;
+			continue;
+		}
+		// a token plus an absolute address is at most 20 bytes
+		if (((tr->end - tr->pos) < 20) && !tr->eof) {
+			refill(tr);
+			continue;
+		}
+		if (tr->pos == tr->end) {
+			break;
+		}
+
+		tr->line++;
+		if (get_varint(&tr->pos, tr->end, &token) < 0) {
+			goto bad;
+		}
+		tr->prev_rw = (token & 1) ? WRITE : READ;
+		if (!(token & 2)) {
+			delta = token >> 2;
+			tr->prev_address += (delta >> 1) ^ -(delta & 1);
+		} else if (token >> 2) {
+			tr->run_left = token >> 2;
+			continue;
+		} else if (get_varint(&tr->pos, tr->end, &tr->prev_address) < 0) {
+			goto bad;
+		}
+		batch[n].rw = tr->prev_rw;
+		batch[n].address = tr->prev_address;
+		n++;
+	}
+	return n;
+
+bad:
+	tr->malformed++;
+	fprintf(stderr, "%s: record %" PRIu64 ": truncated binary trace\n", tr->name, tr->line);
+	tr->pos = tr->end;
+	tr->eof = 1;
+	return n;
+}
+
+/**
+ * Decode up to max accesses from the trace. Binary traces are decoded from
+ * the same fixed size buffer, so memory use does not depend on trace length.
+ *
+ * @return number of records stored in batch, 0 at end of trace
+ */
+size_t trace_read(trace_reader_t *tr, access_t *batch, size_t max) {
+	size_t n = 0;
+	const char *eol, *next;
+	int ret;
+
+	if (tr->binary) {
+		return read_binary(tr, batch, max);
+	}
+
+	while (n < max) {
+		eol = (const char *) memchr(tr->pos, '\n', tr->end - tr->pos);
+		if (eol) {
+			next = eol + 1;
+		} else if (tr->eof) {
+			if (tr->pos == tr->end) {
+				break;
+			}
+			// last line without a newline
+			eol = tr->end;
+			next = tr->end;
+		} else {
+			if (((size_t) (tr->end - tr->pos) == tr->buf_size)) {
+				// no newline in a full buffer, drop it as one bad line
+				tr->line++;
+				report_malformed(tr, tr->pos, tr->pos + 32);
+				tr->pos = tr->end;
+			}
+			refill(tr);
+			continue;
+		}
+
+		tr->line++;
+		ret = parse_line(tr->pos, eol, &batch[n]);
+		if (ret > 0) {
+			n++;
+		} else if (ret < 0) {
+			report_malformed(tr, tr->pos, eol);
+		}
+		tr->pos = next;
+	}
+	return n;
+}
+
+/**
+ * Read past the next n accesses.
+ *
+ * @return the accesses skipped, fewer than n at the end of the trace
+ */
+uint64_t trace_skip(trace_reader_t *tr, uint64_t n) {
+	access_t batch[TRACE_BATCH];
+	uint64_t skipped = 0;
+	size_t got;
+
+	while (skipped < n) {
+		got = trace_read(tr, batch, (n - skipped < TRACE_BATCH) ? n - skipped : TRACE_BATCH);
+		if (got == 0) {
+			break;
+		}
+		skipped += got;
+	}
+	return skipped;
+}
+
+/**
+ * Check that a binary trace is exact for a configuration with 2^b byte
+ * blocks. SUBBLOCKING also looks at which half of the block is accessed,
+ * so the trace must keep 2^(b-1) bytes apart there.
+ *
+ * @return 0 if it is, -1 with a message if the trace is too coarse
+ */
+int trace_check_block(const trace_reader_t *tr, uint64_t b, char st) {
+	uint64_t unit = ((st == SUBBLOCKING) && (b > 0)) ? b - 1 : b;
+
+	if (tr->block_bits > unit) {
+		fprintf(stderr, "%s: addresses stored at 2^%u bytes, too coarse for B=%" PRIu64
+		        "%s, which needs 2^%" PRIu64 "\n", tr->name, tr->block_bits, b,
+		        (st == SUBBLOCKING) ? " SUBBLOCKING" : "", unit);
+		return -1;
+	}
+	return 0;
+}
+
+void trace_close(trace_reader_t *tr) {
+	if (tr->malformed > TRACE_MAX_REPORTS) {
+		fprintf(stderr, "%s: %" PRIu64 " malformed lines in total\n", tr->name, tr->malformed);
+	}
+	if (tr->map) {
+		munmap(tr->map, tr->map_len);
+	}
+	free(tr->buf);
+	if (tr->own_fd) {
+		close(tr->fd);
+	}
+	memset(tr, 0, sizeof(*tr));
+}
+
+static inline void put_varint(trace_writer_t *tw, uint64_t v) {
+	while (v >= 0x80) {
+		tw->buf[tw->len++] = (uint8_t) (v | 0x80);
+		v >>= 7;
+	}
+	tw->buf[tw->len++] = (uint8_t) v;
+}
+
+static void flush_writer(trace_writer_t *tw) {
+	fwrite(tw->buf, 1, tw->len, tw->out);
+	tw->bytes += tw->len;
+	tw->len = 0;
+}
+
+static void flush_run(trace_writer_t *tw) {
+	if (tw->run) {
+		put_varint(tw, (tw->run << 2) | 2 | (tw->prev_rw == WRITE));
+		tw->run = 0;
+	}
+}
+
+/**
+ * Start a binary trace on out.
+ *
+ * @block_bits Store addresses at 2^block_bits granularity, 0 keeps them exact
+ */
+int trace_writer_open(trace_writer_t *tw, FILE *out, uint8_t block_bits) {
+	uint8_t h[sizeof(trace_header_t)];
+
+	memset(tw, 0, sizeof(*tw));
+	tw->out = out;
+	tw->block_bits = block_bits;
+
+	memset(h, 0, sizeof(h));
+	memcpy(h, TRACE_MAGIC, 4);
+	h[4] = TRACE_VERSION & 0xff;
+	h[5] = TRACE_VERSION >> 8;
+	h[6] = block_bits;
+	if (fwrite(h, 1, sizeof(h), out) != sizeof(h)) {
+		return -1;
+	}
+	tw->bytes = sizeof(h);
+	return 0;
+}
+
+void trace_write(trace_writer_t *tw, char rw, uint64_t address) {
+	uint64_t zz;
+
+	address &= ~((1ULL << tw->block_bits) - 1);
+	if ((rw == tw->prev_rw) && (address == tw->prev_address)) {
+		tw->run++;
+		tw->records++;
+		return;
+	}
+	flush_run(tw);
+
+	// room for a worst case token and address
+	if (tw->len > sizeof(tw->buf) - 32) {
+		flush_writer(tw);
+	}
+	zz = address - tw->prev_address;
+	zz = (zz << 1) ^ -(zz >> 63);
+	if (zz >> 62) {
+		put_varint(tw, 2 | (rw == WRITE));
+		put_varint(tw, address);
+	} else {
+		put_varint(tw, (zz << 2) | (rw == WRITE));
+	}
+	tw->prev_rw = rw;
+	tw->prev_address = address;
+	tw->records++;
+}
+
+int trace_writer_close(trace_writer_t *tw) {
+	flush_run(tw);
+	flush_writer(tw);
+	return fflush(tw->out);
+}
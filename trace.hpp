@@ -0,0 +1,82 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "cachesim.hpp"
+
+// number of decoded accesses handed out per trace_read() call
+#define TRACE_BATCH 4096
+// size of the read buffer used when the input cannot be mmapped
+#define TRACE_BUFFER_SIZE (1 << 20)
+// malformed lines reported individually before we only count them
+#define TRACE_MAX_REPORTS 10
+
+/*
+ * Binary trace format
+ *
+ * A 16 byte header followed by one varint token per record:
+ *   (zigzag(address - previous address) << 2) | w     plain record
+ *   (count << 2) | 2 | w                              previous record repeats count more times
+ *   (0 << 2) | 2 | w, varint address                  absolute address (delta too large)
+ * with w = 1 for a write. When block_bits is non zero the converter stored
+ * addresses truncated to 2^block_bits bytes, which is exact for any
+ * configuration whose (sub)block is at least that large.
+ */
+#define TRACE_MAGIC "\x89" "CTR"
+#define TRACE_VERSION 1
+
+struct trace_header_t {
+	char     magic[4];
+	uint16_t version;
+	uint8_t  block_bits;
+	uint8_t  flags;
+	uint64_t reserved;
+};
+
+struct trace_reader_t {
+	const char *name;
+	int fd;
+	int own_fd;
+	int binary;
+	// mmap mode: the whole file is one buffer
+	char *map;
+	size_t map_len;
+	// stream mode: refilled with large read() calls
+	char *buf;
+	size_t buf_size;
+	// [pos, end) is the unparsed window of map or buf
+	const char *pos;
+	const char *end;
+	int eof;
+	uint64_t line;
+	uint64_t bytes;
+	uint64_t malformed;
+	// binary decoder state
+	uint8_t block_bits;
+	char prev_rw;
+	uint64_t prev_address;
+	uint64_t run_left;
+};
+
+struct trace_writer_t {
+	FILE *out;
+	uint8_t block_bits;
+	char prev_rw;
+	uint64_t prev_address;
+	uint64_t run;
+	uint64_t records;
+	uint64_t bytes;
+	size_t len;
+	uint8_t buf[1 << 16];
+};
+
+int trace_open(trace_reader_t *tr, const char *path);
+size_t trace_read(trace_reader_t *tr, access_t *batch, size_t max);
+uint64_t trace_skip(trace_reader_t *tr, uint64_t n);
+void trace_close(trace_reader_t *tr);
+int trace_check_block(const trace_reader_t *tr, uint64_t b, char st);
+
+int trace_writer_open(trace_writer_t *tw, FILE *out, uint8_t block_bits);
+void trace_write(trace_writer_t *tw, char rw, uint64_t address);
+int trace_writer_close(trace_writer_t *tw);
+
+#endif /* TRACE_HPP */